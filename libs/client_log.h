@@ -0,0 +1,37 @@
+#ifndef CLIENT_LOG_H
+#define CLIENT_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "array_list.h"
+
+#define CLIENT_LOG_BLOCK (64 * 1024)
+#define CLIENT_LOG_DEFAULT_CAP (8 * 1024 * 1024)
+
+// Append-only history of received broadcasts. Recent bytes sit in
+// fixed-size blocks in memory; once they exceed the cap the oldest
+// blocks are spilled to an unlinked temp file, so a long session costs
+// disk rather than memory and LOG? still sees everything.
+typedef struct client_log
+{
+    array_list *blocks; // char[CLIENT_LOG_BLOCK] each, oldest first
+    size_t tail_len;    // bytes used in the last block
+    size_t mem_cap;     // 0 keeps everything in memory
+
+    int spill_fd; // -1 until the first spill
+    uint64_t spilled_len;
+    uint64_t total_len;
+} client_log;
+
+client_log *client_log_create(size_t mem_cap);
+void client_log_free(client_log *log);
+
+void client_log_append(client_log *log, const char *data, size_t len);
+
+// Writes the whole history, spilled part first. Returns 0 on success,
+// -1 on a read or write error.
+int client_log_write(const client_log *log, FILE *out);
+
+#endif
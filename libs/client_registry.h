@@ -0,0 +1,74 @@
+#ifndef CLIENT_REGISTRY_H
+#define CLIENT_REGISTRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ipc_helpers.h"
+#include "rcu.h"
+
+// Slot map of a document's connected clients. A handle packs the slot
+// index with the slot's generation, which removal bumps, so a stale
+// handle never reaches whoever reuses the slot. Add and remove are O(1);
+// the broadcaster iterates a dense copy it rebuilds only after churn,
+// without taking the registry lock.
+typedef uint64_t client_handle; // generation << 32 | slot index
+
+typedef struct client_slot
+{
+    client_info *client; // NULL while free
+    uint32_t generation;
+    uint32_t next_free;
+} client_slot;
+
+typedef struct client_registry
+{
+    pthread_mutex_t lock; // guards slots and the free list
+    client_slot *slots;
+    uint32_t cap;
+    uint32_t free_head; // UINT32_MAX: none
+    atomic_size_t count;
+    atomic_uint_fast64_t epoch; // bumped by every add and remove
+
+    // Iteration copy, touched only by the (single) broadcasting thread
+    rcu_domain rcu;
+    client_info **iter;
+    size_t iter_count;
+    size_t iter_cap;
+    uint64_t iter_epoch;
+} client_registry;
+
+typedef struct client_iter
+{
+    client_info **clients;
+    size_t count;
+    unsigned rcu_slot;
+} client_iter;
+
+client_registry *client_registry_create(void);
+
+// Frees the registry, passing each remaining client to `free_client`.
+void client_registry_free(client_registry *r, void (*free_client)(client_info *));
+
+client_handle client_registry_add(client_registry *r, client_info *c);
+
+// Unregisters the client and waits until no broadcast can still see it,
+// so the caller may close and free it. NULL if the handle is stale.
+client_info *client_registry_remove(client_registry *r, client_handle h);
+
+// NULL if the handle is stale.
+client_info *client_registry_get(client_registry *r, client_handle h);
+
+size_t client_registry_count(client_registry *r);
+
+// Calls `fn` on every registered client under the registry lock, so
+// none can be freed meanwhile. For occasional readers like STATS?.
+void client_registry_for_each(client_registry *r, void (*fn)(client_info *, void *), void *arg);
+
+// Brackets one pass over the connected clients. Clients added after
+// begin are not included; removed ones stay valid until end.
+void client_registry_iter_begin(client_registry *r, client_iter *it);
+void client_registry_iter_end(client_registry *r, client_iter *it);
+
+#endif
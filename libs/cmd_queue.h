@@ -0,0 +1,42 @@
+#ifndef CMD_QUEUE_H
+#define CMD_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "array_list.h"
+#include "ipc_helpers.h"
+
+// Unbounded single-producer / single-consumer queue of commands.
+// The producer is the connection thread that owns the client, the
+// consumer is the tick; neither side ever takes a lock.
+typedef struct cmd_node
+{
+    cmd_ipc *cmd;
+    _Atomic(struct cmd_node *) next;
+} cmd_node;
+
+typedef struct cmd_queue
+{
+    cmd_node *head; // consumer side (stub node)
+    cmd_node *tail; // producer side
+    atomic_bool closed;
+} cmd_queue;
+
+cmd_queue *cmd_queue_create(void);
+void cmd_queue_free(cmd_queue *q);
+
+// === Producer side ===
+void cmd_queue_push(cmd_queue *q, cmd_ipc *cmd);
+void cmd_queue_close(cmd_queue *q);
+
+// === Consumer side ===
+cmd_ipc *cmd_queue_pop(cmd_queue *q);
+bool cmd_queue_is_closed(cmd_queue *q);
+
+// Drains every queue in `queues`, plus the already ordered `carry`
+// (may be NULL), and appends the commands to `out` ordered by
+// (timestamp, seq) via a k-way heap merge.
+size_t cmd_queue_merge(array_list *queues, array_list *carry, array_list *out);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef DOC_REGISTRY_H
+#define DOC_REGISTRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "array_list.h"
+#include "document.h"
+
+#define DOC_NAME_MAX 64
+#define DEFAULT_DOC_NAME "doc" // clients that name no document; saved to doc.md
+
+struct client_registry;
+struct segment_log;
+struct log_index;
+struct shared_snapshot;
+struct throttle;
+struct doc_stats;
+
+// Committed state as readers see it. Immutable once published; the tick
+// swaps in a new one after each commit, so readers only hold view_lock
+// long enough to take a reference.
+typedef struct doc_view
+{
+    atomic_int refs;
+    uint64_t version;
+    uint64_t checksum; // snapshot_checksum() of data
+    char *data;        // '\0'-terminated
+    size_t len;
+    line_mark *line_marks; // the document's, for resolve_doc_range()
+    size_t marks;
+} doc_view;
+
+// One hosted document and everything its tick owns. Documents share
+// nothing but the server's worker pool, so each has its own locks,
+// command queues, version counter and log.
+typedef struct hosted_doc
+{
+    char *name;
+    char *path; // written on QUIT
+
+    // Only the tick touches the engine, so it needs no lock
+    document *doc;
+    uint64_t version;
+    uint64_t checksum; // snapshot_checksum() of the committed snapshot
+
+    doc_view *view;
+    pthread_rwlock_t view_lock;
+    struct shared_snapshot *snapshot_cache;
+    pthread_mutex_t snapshot_cache_mutex;
+
+    struct client_registry *clients;
+
+    array_list *cmd_queues;
+    pthread_mutex_t cmd_queue_mutex;
+    array_list *cmd_list;  // current tick's batch, owned by the tick
+    array_list *cmd_carry; // held back by admission control, in order
+    struct throttle *throttle;
+
+    struct segment_log *log;
+    struct log_index *log_index;
+    pthread_rwlock_t log_lock; // appends write; queries and deltas read, then stream unlocked
+
+    // Entry being built by the tick: [log_start, log_len) of log_entry
+    char *log_entry;
+    size_t log_start;
+    size_t log_len;
+    size_t log_cap;
+    uint64_t log_version;
+    uint64_t log_offset; // UINT64_MAX: entry is not logged
+
+    // The entry again with its engine splices, for clients that asked
+    // for deltas. Built only while delta_clients is non-zero.
+    char *delta_entry;
+    size_t delta_len; // 0: broadcast the plain entry to everyone
+    size_t delta_cap;
+    atomic_size_t delta_clients;
+
+    // Idle tick coalescing
+    uint64_t idle_run_ticks;
+    uint64_t idle_run_version;
+    struct timespec last_broadcast;
+
+    // Result of the last tick, read by the main loop after the pool joins
+    size_t tick_cmds;
+    size_t tick_bytes;
+    struct doc_stats *stats;
+} hosted_doc;
+
+// Opens the default document. Returns -1 if its log cannot be created.
+int doc_registry_init(void);
+
+// Finds or creates a document. NULL if the name is invalid, its log
+// cannot be created, or --max-docs documents are already hosted.
+hosted_doc *doc_registry_open(const char *name);
+
+// Finds an existing document without creating it.
+hosted_doc *doc_registry_find(const char *name);
+
+hosted_doc *doc_registry_default(void);
+
+// Appends every hosted document to `out`. Documents live until
+// doc_registry_free(), so the pointers stay valid.
+void doc_registry_list(array_list *out);
+
+void doc_registry_free(void);
+
+// Publishes the engine's freshly flattened snapshot with the document's
+// current version and checksum. The view takes ownership of the buffer
+// and its line index, so the tick must detach doc->snapshot and
+// doc->line_marks before the next commit.
+void hosted_doc_publish(hosted_doc *d);
+
+doc_view *doc_view_acquire(hosted_doc *d);
+void doc_view_release(doc_view *v);
+
+#endif
@@ -2,6 +2,7 @@
 #define DOCUMENT_H
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include "array_list.h"
@@ -17,7 +18,8 @@ typedef enum
     BLOCKQUOTE,
     UNORDERED_LIST_ITEM,
     ORDERED_LIST_ITEM,
-    HORIZONTAL_RULE
+    HORIZONTAL_RULE,
+    LAZY_SPAN // unparsed lines of an adopted snapshot, see adopt_snapshot_lazily()
 
 } chunk_type;
 
@@ -30,6 +32,13 @@ typedef struct chunk
 
     char *text;   
     int index_OL; // valid only if type == ORDERED_LIST_ITEM
+
+    // text_hash() of text and TEXT_HASH_BASE^len, cached until the text changes
+    uint64_t hash;
+    uint64_t hash_pow;
+    bool hashed;
+
+    size_t lines; // valid only if type == LAZY_SPAN
     
     struct chunk *next;
     struct chunk *previous;
@@ -43,6 +52,23 @@ typedef struct meta_pos
 
 } meta_pos;
 
+// One resolved change to the working text, in the order it was made:
+// `del` bytes at `pos` replaced by the `len` bytes of `text`
+typedef struct text_splice
+{
+    size_t pos;
+    size_t del;
+    size_t len;
+    char text[];
+} text_splice;
+
+// Where a chunk starts in the snapshot and the line it starts on
+typedef struct line_mark
+{
+    size_t offset;
+    size_t line;
+} line_mark;
+
 typedef struct range{
     size_t start; // inclusive
     size_t end; //exclusive
@@ -84,6 +110,23 @@ typedef struct
         
     char* snapshot;
     size_t snapshot_len;
+    uint64_t snapshot_hash; // text_hash() of snapshot, folded from the chunk hashes
+    line_mark *line_marks;  // one per chunk, then {snapshot_len, snapshot_lines}
+    size_t snapshot_marks;
+    size_t snapshot_lines;
+
+    // Buffer the LAZY_SPAN chunks borrow their text from, released by
+    // the first commit that finds none left
+    char *lazy_base;
+    size_t lazy_spans;
+    size_t lazy_mapped; // nonzero: lazy_base is a read-only mmap of this many bytes
+
+    // Time spent in each step of the last commit
+    uint64_t commit_delete_ns;
+    uint64_t commit_insert_ns;
+    uint64_t commit_flatten_ns;
+
+    array_list* splices; // text_splice*, recorded by the naive ops while non-NULL
 
     array_list* meta_log;
     array_list* deleted_ranges;
@@ -94,9 +137,27 @@ typedef struct
 
 
 void update_meta_log(array_list *meta_positions, size_t snapshot_pos, int offset);
+void record_splice(document *doc, size_t pos, size_t del, const char *text, size_t len);
 range *clamp_to_valid(document *doc, size_t pos);
 size_t map_snapshot_to_working(array_list *meta_log, size_t clamped_snapshot_pos);
-char *flatten_document(document *doc);
+char *flatten_document(document *doc); // also sets snapshot_hash and line_marks
+void index_snapshot(document *doc);     // the same for a snapshot adopted as is
+
+// Adopts `snapshot` (heap-allocated, taken over) without parsing it: the
+// chunks are spans of whole lines that borrow its text, and a line is
+// only parsed into a chunk of its own once an edit locates it. The
+// snapshot hash is left for the first commit to fold.
+void adopt_snapshot_lazily(document *doc, char *snapshot, size_t len);
+void infer_chunk_type(const char *line, size_t len, chunk_type *type_out, int *index_OL_out);
+bool span_has_ordered_item(const Chunk *span); // without parsing it into chunks
+
+// === Content hash ===
+// Polynomial hash mod 2^61-1: a document's hash folds from its chunks'
+// without rereading their bytes
+#define TEXT_HASH_BASE 1000003ULL
+uint64_t text_hash(const char *text, size_t len, uint64_t *pow_out);
+uint64_t document_hash(document *doc);
+
 // === NAIVE DOC STRUCTURE HELPERS ===
 // === Document helpers ===
 Chunk* locate_chunk(document* doc, size_t pos, size_t* local_pos);
@@ -109,7 +170,7 @@ void free_chunk(Chunk *chunk);
 size_t calculate_cap(size_t content_size);
 void chunk_ensure_cap(Chunk *curr, size_t extra_content);
 void chunk_insert(Chunk *curr, size_t local_pos, const char *content, size_t content_size);
-void renumber_list_from(Chunk *start);
+void renumber_list_from(document *doc, Chunk *start);
 int prev_ol_index(Chunk *chunk);
 
 #endif 
@@ -0,0 +1,33 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing string -> pointer map. Keys are copied; values are
+// owned by the caller unless a free function is passed to hash_map_free.
+typedef struct hash_entry
+{
+    char *key; // NULL for an empty slot
+    uint64_t hash;
+    void *value;
+} hash_entry;
+
+typedef struct hash_map
+{
+    hash_entry *entries;
+    size_t capacity; // always a power of two
+    size_t size;
+} hash_map;
+
+uint64_t hash_string(const char *key);
+
+hash_map *hash_map_create(size_t capacity);
+void hash_map_free(hash_map *map, void (*free_value)(void *));
+
+void *hash_map_get(const hash_map *map, const char *key);
+
+// Inserts or replaces; returns the previous value (or NULL).
+void *hash_map_put(hash_map *map, const char *key, void *value);
+
+#endif
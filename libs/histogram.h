@@ -0,0 +1,30 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear histogram in the style of HdrHistogram: every power of two
+// is split into 16 sub-buckets, so a recorded value is known to within
+// about 6% across the whole 64-bit range, in a fixed 8 KB. Recording is
+// a bit scan and an increment.
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} histogram;
+
+void histogram_record(histogram *h, uint64_t value);
+
+// Upper bound of the bucket holding quantile `q` (0..1), capped at max
+uint64_t histogram_quantile(const histogram *h, double q);
+
+// Adds every count of `src` into `dst`
+void histogram_merge(histogram *dst, const histogram *src);
+
+#endif
@@ -5,9 +5,11 @@
 #define INTERNAL_ERROR 1002
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <sys/types.h>
 #include "document.h"
 
 // === Shared declarations ===
@@ -16,65 +18,92 @@ typedef struct cmd_ipc {
     char *role;
     char *raw_command;
     struct timeval timestamp;
+    uint64_t seq; // arrival order, breaks timestamp ties
+    bool held;    // carried over by admission control at least once
 } cmd_ipc;
 
+struct cmd_queue;
+struct hosted_doc;
+
 typedef struct client_info {
     pid_t pid;
     int fd_s2c;
     char *username;
     char *permission;
+    uint64_t handle; // client_handle in the document's registry
+    bool deltas;     // wants SPLICE lines with each broadcast
+
+    // While the handshake is in flight broadcasts are queued here
+    // instead of being interleaved with the snapshot or delta.
+    // `lock` guards the fields below and writes to fd_s2c.
+    pthread_mutex_t lock;
+    bool pending;
+    uint64_t resume_offset; // log records before this are already in the delta
+    char *backlog;
+    size_t backlog_len;
+    size_t backlog_cap;
 } client_info;
 
+// Options a client may append to its username line: "<user> key=value ..."
+typedef struct handshake_opts {
+    bool map_snapshot; // map=1: client maps the snapshot via /proc/<pid>/fd
+    bool resume;       // since=<version> sum=<checksum>: client holds that version
+    uint64_t since;
+    uint64_t checksum;
+    char *doc;         // doc=<name>; NULL selects the default document
+    bool deltas;       // deltas=1: broadcasts carry the resolved splices
+} handshake_opts;
+
 char *read_line_dynamic(int fd);
+int write_all(int fd, const void *data, size_t len);
+int send_file_range(int out_fd, int in_fd, off_t off, size_t len);
 int process_raw_command(document *doc, cmd_ipc *cmd);
 
-// === Server-side globals ===
-#ifndef BUILD_CLIENT
-extern document *global_doc;
-extern pthread_mutex_t doc_mutex;
-
-extern array_list *connected_clients;
-extern pthread_mutex_t client_list_mutex;
-
-extern array_list *global_cmd_list;
-extern pthread_mutex_t cmd_list_mutex;
+// Identifies a snapshot's contents for resync (text_hash())
+uint64_t snapshot_checksum(const char *data, size_t len);
 
-extern char *current_log_entry;
-extern size_t current_log_len;
-extern size_t current_log_cap;
-
-extern char *server_log;
-extern size_t server_log_len;
-extern pthread_mutex_t log_mutex;
-
-extern uint64_t global_version;
+// Resolves the arguments of "DOC? lines <a> <b>" or "DOC? bytes <a> <b>",
+// half-open and clamped to the snapshot, to a byte range through the
+// snapshot's line marks. Returns -1 if they are malformed.
+int resolve_doc_range(const char *args, const char *data, size_t len,
+                      const line_mark *marks, size_t nmarks, size_t *from, size_t *to);
 
 // === Server-side helpers ===
-void sleep_ms(unsigned long milliseconds);
-void handle_server_stdin(void);
-void insert_sorted_cmd(cmd_ipc *cmd);
+#ifndef BUILD_CLIENT
+int handle_server_stdin(void);
+void register_cmd_queue(struct hosted_doc *d, struct cmd_queue *q);
+void enqueue_cmd(struct cmd_queue *q, cmd_ipc *cmd);
+size_t collect_cmd_batch(struct hosted_doc *d);
 void free_cmd_ipc(void *ptr);
 void free_server_resources(void);
 
-void reset_log_buffer(void);
-void append_to_log_buffer(const char *data, size_t len);
-void append_to_server_log(void);
-void send_broadcast_to_all_clients(void);
+void reset_log_buffer(struct hosted_doc *d);
+void append_to_log_buffer(struct hosted_doc *d, const char *data, size_t len);
+void set_log_version(struct hosted_doc *d, uint64_t version);
+void append_to_server_log(struct hosted_doc *d);
+void build_delta_entry(struct hosted_doc *d);
+void handle_log_query(struct hosted_doc *d, const char *args);
+void send_broadcast_to_all_clients(struct hosted_doc *d);
+
+void note_idle_tick(struct hosted_doc *d);
+void flush_idle_run(struct hosted_doc *d);
+bool heartbeat_due(struct hosted_doc *d, unsigned long heartbeat_ms, unsigned long interval_ms);
 
 char *trim(char *str);
-void get_user_role(char **username_out, char **role_out, int fd);
+void get_user_role(char **username_out, char **role_out, handshake_opts *opts, int fd);
+int send_bootstrap(struct hosted_doc *d, client_info *c, int fd_c2s, const handshake_opts *opts);
 #endif
 
 // === Client-side globals and helpers ===
 #ifdef BUILD_CLIENT
 extern document *local_doc;
 extern pthread_mutex_t local_doc_mutex;
-extern char *local_log;
+extern struct client_log *local_log;
 extern pthread_mutex_t local_log_mutex;
 
 void markdown_parse_string(document *doc, const char *text);
-void infer_chunk_type(const char *line, size_t len, chunk_type *type_out, int *index_OL_out);
-void apply_broadcast(const char *msg);
+void apply_broadcast(const char *msg, size_t len);
+bool apply_splices(const char *msg, size_t len);
 #endif
 
 #endif // IPC_HELPERS_H
@@ -0,0 +1,42 @@
+#ifndef LOCAL_ECHO_H
+#define LOCAL_ECHO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "array_list.h"
+#include "document.h"
+
+// The client's own edits, shown before the server has applied them.
+// Commands are held from the moment they are sent until a broadcast
+// carries their EDIT line. The view is the last broadcast version with
+// the held commands queued on top as one batch, resolved through the
+// engine's snapshot-to-working mapping exactly as the server will if
+// they land in its next tick. Callers hold local_doc_mutex.
+typedef struct local_echo
+{
+    array_list *pending; // char*, sent commands in order, trailing whitespace trimmed
+    document *view;      // NULL while stale
+    bool enabled;
+} local_echo;
+
+local_echo *local_echo_create(bool enabled);
+void local_echo_free(local_echo *e);
+
+void local_echo_push(local_echo *e, const char *line);
+
+// Drops the commands `username` has had acknowledged by the EDIT lines
+// of one broadcast; any result counts, rejections included.
+void local_echo_ack(local_echo *e, const char *msg, size_t len, const char *username);
+
+// Forgets everything held. Used after a reconnect, when the acks for
+// held commands may have been folded into the new snapshot or delta.
+void local_echo_reset(local_echo *e);
+
+// Marks the view stale after a broadcast moved the base document
+void local_echo_rebase(local_echo *e);
+
+// The base document with the held commands applied under `role`, or the
+// base itself when nothing is held. Rebuilt only when stale.
+document *local_echo_view(local_echo *e, document *base, const char *role);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hash_map.h"
+
+// Version -> byte offset index over the records of a segment_log,
+// with optional per-user posting lists. Record ids are stable; ids
+// below first_id have been pruned along with their segments.
+typedef struct log_record
+{
+    uint64_t version;
+    uint64_t offset;
+    uint64_t len;
+    uint64_t checksum; // snapshot_checksum() of the document after this record
+} log_record;
+
+typedef struct posting_list
+{
+    size_t *ids;
+    size_t count;
+    size_t cap;
+} posting_list;
+
+typedef struct log_index
+{
+    log_record *records;
+    size_t count; // live records
+    size_t cap;
+    size_t first_id;
+
+    bool track_users;
+    hash_map *users; // username -> posting_list*
+} log_index;
+
+log_index *log_index_create(bool track_users);
+void log_index_free(log_index *idx);
+
+// Indexes a record that was just appended at global `offset`.
+void log_index_add(log_index *idx, uint64_t version, uint64_t checksum,
+                   uint64_t offset, const char *data, size_t len);
+
+// Forgets records that start before `base_offset`.
+void log_index_prune(log_index *idx, uint64_t base_offset);
+
+// First record id with version >= `version` (one past the end if none).
+size_t log_index_lower_bound(const log_index *idx, uint64_t version);
+
+const log_record *log_index_get(const log_index *idx, size_t id);
+const posting_list *log_index_user(const log_index *idx, const char *username);
+
+#endif
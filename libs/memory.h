@@ -5,6 +5,9 @@
 
 void *Calloc(size_t nmemb, size_t size);
 
+// Calls to Calloc() so far, for allocation statistics
+size_t calloc_count(void);
+
 
 
 
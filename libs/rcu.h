@@ -0,0 +1,28 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Minimal sleepable-RCU style domain. Readers bracket their use of a
+// published pointer with rcu_read_lock/unlock and never block; a writer
+// publishes the new pointer, calls rcu_synchronize(), and may then free
+// the old one. Writers are serialised inside the domain.
+typedef struct rcu_domain
+{
+    atomic_uint epoch;
+    atomic_size_t readers[2];
+    pthread_mutex_t writer;
+} rcu_domain;
+
+#define RCU_DOMAIN_INIT {0, {0, 0}, PTHREAD_MUTEX_INITIALIZER}
+
+void rcu_init(rcu_domain *d);
+void rcu_destroy(rcu_domain *d);
+
+unsigned rcu_read_lock(rcu_domain *d);
+void rcu_read_unlock(rcu_domain *d, unsigned slot);
+void rcu_synchronize(rcu_domain *d);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ROLES_H
+#define ROLES_H
+
+// Cached view of roles.txt. The table is loaded once and swapped
+// atomically when the file changes; lookups take no lock.
+
+// Loads `path`; a missing file yields an empty table.
+void roles_init(const char *path);
+
+// Reloads the table if the file's identity or mtime changed.
+void roles_maybe_reload(void);
+
+// Returns a malloc'd copy of the user's role ("read"/"write") or NULL.
+char *roles_lookup(const char *username);
+
+void roles_free(void);
+
+#endif
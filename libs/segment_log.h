@@ -0,0 +1,64 @@
+#ifndef SEGMENT_LOG_H
+#define SEGMENT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "array_list.h"
+
+// Append-only log stored in fixed-size, mmap'd segment files.
+// Segments are packed back to back, so global offset `off` lives in
+// segment (off - base_offset) / segment_size of the retained list.
+typedef struct log_segment
+{
+    uint64_t id;
+    int fd;     // open only while the segment is being written, else -1
+    char *base; // mapping, NULL once the segment is full
+    size_t len; // bytes used
+    size_t first_record; // offset of the first record starting here
+} log_segment;
+
+typedef struct segment_log
+{
+    char *dir;
+    size_t segment_size;
+    size_t retain; // max segments kept, 0 = unlimited
+
+    array_list *segments; // log_segment*, oldest first
+    uint64_t next_id;
+
+    uint64_t base_offset; // global offset of the oldest retained byte
+    uint64_t total_len;   // global offset one past the newest byte
+} segment_log;
+
+segment_log *segment_log_open(const char *dir, size_t segment_size, size_t retain);
+void segment_log_close(segment_log *log);
+
+// Appends one record, spilling into new segments as needed.
+// Returns 0 on success, -1 if a segment could not be created.
+int segment_log_append(segment_log *log, const char *data, size_t len);
+
+// Retained segments covering a byte range. Sealed segments keep no fd,
+// so pinning opens each file by path; a pinned segment may then be
+// dropped by retention, but its fd stays open until the span is
+// released, so readers can stream without holding the log's lock.
+typedef struct log_span
+{
+    uint64_t from; // clamped range
+    uint64_t to;
+    uint64_t start; // global offset of fds[0]
+    size_t segment_size;
+    int *fds;
+    size_t count;
+} log_span;
+
+// Pins global range [from, to), clamped to what is retained and could
+// be opened. Caller must keep appends out (read lock) while pinning,
+// not while streaming.
+void segment_log_pin(segment_log *log, uint64_t from, uint64_t to, log_span *out);
+
+// Streams [from, to) of a pinned span to `out_fd`, clamped to the span.
+// Returns 0 on success, -1 on a write error.
+int log_span_stream(const log_span *span, int out_fd, uint64_t from, uint64_t to);
+void log_span_release(log_span *span);
+
+#endif
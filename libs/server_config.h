@@ -0,0 +1,53 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct server_config
+{
+    unsigned long interval_ms;
+
+    // Adaptive tick scheduling
+    bool adaptive;
+    size_t early_cmds;  // commit early once this many commands are queued
+    size_t early_bytes; // ... or once this many command bytes are queued
+
+    // Idle ticks: 0 broadcasts every tick, otherwise coalesce them into
+    // a keepalive every heartbeat_ms and a single IDLE log record
+    unsigned long heartbeat_ms;
+
+    // Segmented server log
+    const char *log_dir;
+    size_t log_segment_size;
+    size_t log_retain; // segments kept, 0 = unlimited
+    bool log_user_index; // keep per-user postings for LOG? user=<name>
+
+    // Hosted documents, the default one included; 0 = unlimited. Opening
+    // a new document past the cap is rejected as INVALID_DOCUMENT.
+    size_t max_docs;
+
+    // Threads running document ticks, 0 = one per online CPU
+    size_t workers;
+
+    // Admission control, 0 = unlimited. Rates are commands per second
+    // per user; commands over a limit wait for a later tick.
+    size_t rate;
+    size_t rate_read; // overrides `rate` for read-only users
+    size_t burst;     // bucket size, defaults to the rate
+    size_t tick_cmds;
+    size_t tick_bytes;
+
+    // Periodic JSON stats dump, one line per interval; 0 = off
+    unsigned long stats_interval_ms;
+    const char *stats_file;
+} server_config;
+
+extern server_config config;
+
+// Parses `<TIME_INTERVAL_MS> [--option[=value] ...]`.
+// Returns 0 on success, -1 on malformed or unknown arguments.
+int parse_server_config(server_config *cfg, int argc, char *argv[]);
+void print_server_usage(const char *prog);
+
+#endif
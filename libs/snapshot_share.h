@@ -0,0 +1,28 @@
+#ifndef SNAPSHOT_SHARE_H
+#define SNAPSHOT_SHARE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Immutable, sealed memfd copy of a committed snapshot. Handshakes
+// stream it with sendfile() or let the client map it through
+// /proc/<pid>/fd, so joining never copies the document in user space.
+typedef struct shared_snapshot
+{
+    atomic_int refs;
+    uint64_t version;
+    int fd;     // holds len bytes followed by '\0'
+    size_t len;
+} shared_snapshot;
+
+// Returns a referenced snapshot of `data` at `version`, building it only
+// if `*cache` is stale. Caller must hold the lock guarding the cache.
+shared_snapshot *shared_snapshot_acquire(shared_snapshot **cache, const char *data,
+                                         size_t len, uint64_t version);
+void shared_snapshot_release(shared_snapshot *snap);
+
+// Drops the cached snapshot (shutdown).
+void shared_snapshot_reset(shared_snapshot **cache);
+
+#endif
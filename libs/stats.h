@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "histogram.h"
+
+typedef enum tick_phase
+{
+    PHASE_TICK,    // whole committing tick
+    PHASE_APPLY,   // collecting, validating and queueing the batch
+    PHASE_DELETES, // markdown_increment_version() steps
+    PHASE_INSERTS,
+    PHASE_FLATTEN,
+    PHASE_LOG, // server log append
+    PHASE_BROADCAST,
+    PHASE_COUNT
+} tick_phase;
+
+// Per-document counters. Written by the document's tick and read by
+// the main thread between ticks, so neither side locks.
+typedef struct doc_stats
+{
+    histogram phase_ns[PHASE_COUNT];
+    uint64_t commits; // ticks that applied commands
+    uint64_t cmds;
+    uint64_t broadcasts;
+    uint64_t bytes_broadcast; // summed over clients
+    uint64_t log_errors;      // records the server log failed to take
+    size_t doc_bytes;
+    size_t chunks;
+} doc_stats;
+
+uint64_t stats_now_ns(void);
+
+// One JSON object covering the server and every hosted document,
+// including each client's unread bytes in its pipe. Main thread only.
+void stats_write_json(FILE *out);
+
+// Appends a JSON line to config.stats_file once config.stats_interval_ms
+// has passed since the last dump. Called by the main loop after a tick.
+void stats_maybe_dump(void);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "array_list.h"
+#include "hash_map.h"
+
+// Admission control for one document's tick. Each user has a token
+// bucket refilled at the rate for their role, and the tick as a whole
+// has a command and byte budget. Commands that do not fit are carried
+// to the next tick; once one of a user's commands is held back, the
+// rest of theirs wait too, so nobody's edits are reordered.
+// Used by the tick, and read by console queries between ticks.
+typedef struct throttle_bucket
+{
+    double tokens;
+    struct timespec refilled;
+    uint64_t last_tick; // tick the bucket was last refilled in
+    uint64_t held_tick; // tick a command of this user was last held in
+    uint64_t admitted;
+    uint64_t throttled; // commands ever held back by the user's rate
+} throttle_bucket;
+
+typedef struct throttle
+{
+    hash_map *buckets; // username -> throttle_bucket*
+    uint64_t tick;
+    uint64_t budget_deferred; // commands ever held back by the tick budget
+} throttle;
+
+throttle *throttle_create(void);
+void throttle_free(throttle *t);
+
+// Keeps the admitted commands of `batch` (cmd_ipc*, in commit order)
+// and appends the rest to `carry` in the same order. Returns the
+// number of commands admitted.
+size_t throttle_admit(throttle *t, array_list *batch, array_list *carry);
+
+// One line for the document, then one per user seen: THROTTLE? output.
+void throttle_report(const throttle *t, const char *doc_name, size_t carried, FILE *out);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TICK_SCHEDULER_H
+#define TICK_SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "server_config.h"
+
+#define WAKE_TICK 0x1  // commit a batch now
+#define WAKE_INPUT 0x2 // stdin is readable
+
+// Drives the main loop from an absolute-deadline timerfd so the period
+// does not drift with processing time. In adaptive mode producers may
+// kick an early commit through an eventfd, and while nothing is queued
+// the timer is disarmed (or slowed to the heartbeat period).
+typedef struct tick_scheduler
+{
+    int timer_fd;
+    int wake_fd;
+    bool watch_input;
+    unsigned long timer_period_ms; // 0 when disarmed, main loop only
+
+    unsigned long interval_ms;
+    unsigned long heartbeat_ms;
+    bool adaptive;
+    size_t early_cmds;
+    size_t early_bytes;
+
+    atomic_size_t pending_cmds;
+    atomic_size_t pending_bytes;
+    atomic_bool idle; // timer disarmed, the next command commits at once
+} tick_scheduler;
+
+extern tick_scheduler scheduler;
+
+int tick_scheduler_init(tick_scheduler *s, const server_config *cfg);
+void tick_scheduler_destroy(tick_scheduler *s);
+
+// Blocks until the next tick and/or stdin activity; returns WAKE_* flags.
+unsigned tick_scheduler_wait(tick_scheduler *s);
+
+// Producer side: called for every command handed to the tick.
+void tick_scheduler_note_enqueue(tick_scheduler *s, size_t bytes);
+
+// Consumer side: called after a tick drained `cmds` commands of `bytes`.
+void tick_scheduler_note_commit(tick_scheduler *s, size_t cmds, size_t bytes);
+
+// Stops polling stdin (e.g. after EOF).
+void tick_scheduler_ignore_input(tick_scheduler *s);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Chrome trace-event instrumentation. Build with `make TRACE=1` (adds
+// -DENABLE_TRACE) to record begin/end events into per-thread rings;
+// otherwise the macros expand to nothing. Names must be string
+// literals, as only the pointer is stored.
+#ifdef ENABLE_TRACE
+
+void trace_record(const char *name, char phase);
+void trace_thread_name(const char *name);
+
+#define TRACE_BEGIN(name) trace_record((name), 'B')
+#define TRACE_END(name) trace_record((name), 'E')
+#define TRACE_INSTANT(name) trace_record((name), 'i')
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+
+#else
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+// Writes the events still held in every ring to `path` as trace-event
+// JSON (load it in chrome://tracing or Perfetto). Returns the number of
+// events written, or -1 on error or when tracing is compiled out.
+long trace_dump(const char *path);
+
+#endif
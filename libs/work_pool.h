@@ -0,0 +1,57 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed pool of threads with one deque each. Submitted tasks are dealt
+// round-robin; a worker pops its own deque from the back and, when that
+// is empty, steals from the front of the others, so a few expensive
+// tasks never leave the rest of the pool idle.
+
+typedef void (*work_fn)(void *arg);
+
+typedef struct work_task
+{
+    work_fn fn;
+    void *arg;
+} work_task;
+
+typedef struct work_deque
+{
+    pthread_mutex_t lock;
+    work_task *tasks; // ring buffer
+    size_t head;      // next to steal
+    size_t count;
+    size_t cap;
+} work_deque;
+
+typedef struct work_pool
+{
+    size_t nthreads;
+    pthread_t *threads;
+    work_deque *deques;
+    size_t next; // round-robin cursor, submitting thread only
+
+    atomic_size_t queued;     // submitted, not yet taken
+    atomic_size_t unfinished; // submitted, not yet completed
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv; // workers wait for tasks
+    pthread_cond_t done_cv; // work_pool_wait() waits for completion
+    bool stopping;
+} work_pool;
+
+// `nthreads` of 0 uses one thread per online CPU.
+work_pool *work_pool_create(size_t nthreads);
+void work_pool_destroy(work_pool *pool);
+
+void work_pool_submit(work_pool *pool, work_fn fn, void *arg);
+
+// Runs queued tasks on the calling thread too, and returns once every
+// submitted task has completed.
+void work_pool_wait(work_pool *pool);
+
+#endif
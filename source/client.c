@@ -7,19 +7,35 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
 
+#include "client_log.h"
 #include "ipc_helpers.h"
+#include "local_echo.h"
 #include "markdown.h"
 
 #define FIFO_NAME_MAX 256
-#define BUF_SIZE 4096
+#define BUF_SIZE 4096 // initial capacity; the framing buffer grows to fit
+#define OUTBOX_MAX (64 * 1024) // a burst is flushed early once it fills this
+#define HANDSHAKE_POLL_S 1 // checks that the server is alive while it answers SIGRTMIN
+#define RECONNECT_BACKOFF_MAX_MS 2000
+
+// client_handshake() results
+#define HANDSHAKE_OK 0
+#define HANDSHAKE_RETRY -1    // the connection failed partway; worth another try
+#define HANDSHAKE_REJECTED -2 // the server turned us away
 
 document *local_doc = NULL;
-char *local_log = NULL;
+client_log *local_log = NULL;
+local_echo *local_edits = NULL; // our sent, unacknowledged edits; under local_doc_mutex
 char *permission = NULL;
 uint64_t last_logged_version = 0;
+uint64_t applied_version = 0; // version local_doc reflects, sent back on resume
 
 pthread_mutex_t local_doc_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t local_log_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -27,61 +43,178 @@ pthread_mutex_t local_log_mutex = PTHREAD_MUTEX_INITIALIZER;
 int fd_c2s = -1;
 int fd_s2c = -1;
 
+// The listener re-handshakes when the server drops our pipes while it is
+// still running; commands typed meanwhile wait for the new connection.
+pid_t server_pid = 0;
+const char *client_username = NULL;
+const char *client_document = NULL; // NULL: the server's default document
+bool client_deltas = false;          // ask for server-resolved splices
+bool client_lazy = false;            // adopt snapshots with adopt_snapshot_lazily()
+pthread_mutex_t conn_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t conn_cond = PTHREAD_COND_INITIALIZER;
+bool conn_ready = false;
+bool conn_closed = false;
+bool disconnecting = false;
+static bool resync_pending = false; // local_doc diverged; listener thread only
+
 void *pipe_listener_thread(void *arg);
 void client_apply_broadcast(const char *msg);
 
 void cleanup_client(void);
-void client_handshake(pid_t server_pid, const char *username);
+int client_handshake(bool resume);
+static char *map_server_snapshot(const char *map_line, size_t *len_out, size_t *mapped_out);
+static void process_broadcast(const char *msg, size_t len);
+static int send_to_server(const char *data, size_t len);
+
+// Stdin, split into lines of any length
+typedef struct line_reader
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t start; // first byte not yet returned
+    bool eof;
+} line_reader;
+
+static char *read_input_line(line_reader *r);
+static int outbox_add(const char *line);
+static int outbox_flush(void);
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    // Options may appear anywhere; the rest are positional
+    size_t log_mem = CLIENT_LOG_DEFAULT_CAP;
+    bool echo = true;
+    const char *args[3];
+    int nargs = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--log-mem=", 10) == 0)
+            log_mem = strtoull(argv[i] + 10, NULL, 10);
+        else if (strcmp(argv[i], "--deltas") == 0)
+            client_deltas = true;
+        else if (strcmp(argv[i], "--no-echo") == 0)
+            echo = false;
+        else if (strcmp(argv[i], "--lazy") == 0)
+            client_lazy = true;
+        else if (nargs < 3 && argv[i][0] != '-')
+            args[nargs++] = argv[i];
+        else
+        {
+            nargs = -1;
+            break;
+        }
+    }
+
+    if (nargs != 2 && nargs != 3)
     {
-        fprintf(stderr, "Usage: %s <server_pid> <username>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--log-mem=BYTES] [--deltas] [--no-echo] [--lazy] <server_pid> <username> [document]\n"
+                        "  --log-mem  LOG? history kept in memory before spilling to a temp\n"
+                        "             file (default %d, 0 keeps it all in memory)\n"
+                        "  --deltas   apply the server's resolved splices instead of\n"
+                        "             re-running each edit\n"
+                        "  --no-echo  DOC? shows only what the server has applied, not our\n"
+                        "             own edits still in flight\n"
+                        "  --lazy     keep the snapshot as received and parse only the lines\n"
+                        "             that edits touch; for viewers of large documents\n",
+                argv[0], CLIENT_LOG_DEFAULT_CAP);
         return 1;
     }
 
-    pid_t server_pid = (pid_t)atoi(argv[1]);
-    const char *username = argv[2];
+    server_pid = (pid_t)atoi(args[0]);
+    client_username = args[1];
+    client_document = nargs == 3 ? args[2] : NULL;
+    local_log = client_log_create(log_mem);
+    local_edits = local_echo_create(echo);
 
-    client_handshake(server_pid, username);
+    if (client_handshake(false) != HANDSHAKE_OK)
+    {
+        cleanup_client();
+        return 1;
+    }
+    conn_ready = true;
 
     pthread_t listener_thread;
     pthread_create(&listener_thread, NULL, pipe_listener_thread, NULL);
 
-    char line[512];
-    while (fgets(line, sizeof(line), stdin))
+    line_reader input = {0};
+    char *line;
+    while ((line = read_input_line(&input)))
     {
-        if (strcmp(line, "DOC?\n") == 0)
+        if (strcmp(line, "DOC?") == 0)
+        {
+            pthread_mutex_lock(&local_doc_mutex);
+            markdown_print(local_echo_view(local_edits, local_doc, permission), stdout);
+            pthread_mutex_unlock(&local_doc_mutex);
+            continue;
+        }
+        else if (strncmp(line, "DOC? ", 5) == 0)
         {
+            // "DOC? lines <a> <b>" or "DOC? bytes <a> <b>": just that slice
             pthread_mutex_lock(&local_doc_mutex);
-            markdown_print(local_doc, stdout);
+            document *view = local_echo_view(local_edits, local_doc, permission);
+            size_t from, to;
+            if (resolve_doc_range(line + 5, view->snapshot, view->snapshot_len,
+                                  view->line_marks, view->snapshot_marks, &from, &to) < 0)
+                printf("Usage: DOC? [lines|bytes <from> <to>]\n");
+            else if (view->snapshot)
+                fwrite(view->snapshot + from, 1, to - from, stdout);
             pthread_mutex_unlock(&local_doc_mutex);
             continue;
         }
-        else if (strcmp(line, "LOG?\n") == 0)
+        else if (strcmp(line, "LOG?") == 0)
         {
             pthread_mutex_lock(&local_log_mutex);
-            printf("%s", local_log ? local_log : "");
+            client_log_write(local_log, stdout);
             pthread_mutex_unlock(&local_log_mutex);
             continue;
         }
-        else if (strcmp(line, "PERM?\n") == 0)
+        else if (strcmp(line, "PERM?") == 0)
         {
             printf("%s", permission ? permission : "(no permission info)\n");
             continue;
         }
-        else if (strcmp(line, "DISCONNECT\n") == 0)
+        else if (strcmp(line, "FLUSH") == 0)
         {
-            dprintf(fd_c2s, "DISCONNECT\n");
-            break;
+            // Scripted editors can bound how long their commands sit here
+            if (outbox_flush() < 0)
+                break;
+            continue;
         }
-
-        if (write(fd_c2s, line, strlen(line)) < 0)
+        else if (strcmp(line, "DISCONNECT") == 0)
         {
+            outbox_flush();
+            pthread_mutex_lock(&conn_mutex);
+            disconnecting = true;
+            if (conn_ready)
+                dprintf(fd_c2s, "DISCONNECT\n");
+            pthread_mutex_unlock(&conn_mutex);
             break;
         }
+        else if (strcmp(line, "RECONNECT") == 0)
+        {
+            // Drops the connection; the listener resumes from our version
+            if (outbox_flush() < 0)
+                break;
+            pthread_mutex_lock(&conn_mutex);
+            if (conn_ready)
+            {
+                dprintf(fd_c2s, "DISCONNECT\n");
+                conn_ready = false;
+            }
+            pthread_mutex_unlock(&conn_mutex);
+            continue;
+        }
+
+        // Held before sending so its broadcast cannot overtake it
+        pthread_mutex_lock(&local_doc_mutex);
+        local_echo_push(local_edits, line);
+        pthread_mutex_unlock(&local_doc_mutex);
+
+        if (outbox_add(line) < 0)
+            break;
     }
+    free(input.buf);
 
     pthread_join(listener_thread, NULL);  // wait for clean shutdown
     cleanup_client();
@@ -89,7 +222,126 @@ int main(int argc, char *argv[])
 }
 
 
-void client_handshake(pid_t server_pid, const char *username)
+static int send_to_server(const char *data, size_t len)
+{
+    pthread_mutex_lock(&conn_mutex);
+    while (!conn_ready && !conn_closed)
+        pthread_cond_wait(&conn_cond, &conn_mutex);
+    int rc = conn_closed ? -1 : write_all(fd_c2s, data, len);
+    pthread_mutex_unlock(&conn_mutex);
+    return rc;
+}
+
+// === Batched sends ===
+
+// Commands wait here and go to the server in one write when stdin has
+// nothing more ready, when the outbox fills, or on FLUSH. Main thread only.
+static char *outbox = NULL;
+static size_t outbox_len = 0;
+static size_t outbox_cap = 0;
+
+static int outbox_flush(void)
+{
+    if (outbox_len == 0)
+        return 0;
+    int rc = send_to_server(outbox, outbox_len);
+    outbox_len = 0;
+    return rc;
+}
+
+static int outbox_add(const char *line)
+{
+    size_t len = strlen(line);
+    if (outbox_len + len + 1 > outbox_cap)
+    {
+        outbox_cap = (outbox_len + len + 1) * 2;
+        outbox = realloc(outbox, outbox_cap);
+    }
+    memcpy(outbox + outbox_len, line, len);
+    outbox[outbox_len + len] = '\n';
+    outbox_len += len + 1;
+
+    return outbox_len >= OUTBOX_MAX ? outbox_flush() : 0;
+}
+
+// Next line without its '\n', valid until the next call; NULL at the end
+// of input or once the server is gone. Before blocking for more input
+// the outbox is flushed, so a typed command goes out at once while a
+// piped burst is read and sent in large batches.
+static char *read_input_line(line_reader *r)
+{
+    while (1)
+    {
+        char *nl = r->start < r->len ? memchr(r->buf + r->start, '\n', r->len - r->start) : NULL;
+        if (nl)
+        {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            r->start = (size_t)(nl + 1 - r->buf);
+            return line;
+        }
+
+        if (r->eof)
+        {
+            if (r->start < r->len)
+            {
+                // An unterminated last line
+                char *line = r->buf + r->start;
+                r->buf[r->len] = '\0';
+                r->start = r->len;
+                return line;
+            }
+            outbox_flush();
+            return NULL;
+        }
+
+        struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+        if (poll(&pfd, 1, 0) <= 0 && outbox_flush() < 0)
+            return NULL;
+
+        // Keep the partial line, and grow when it fills the buffer
+        if (r->start > 0)
+        {
+            memmove(r->buf, r->buf + r->start, r->len - r->start);
+            r->len -= r->start;
+            r->start = 0;
+        }
+        if (r->cap - r->len < BUF_SIZE)
+        {
+            r->cap = r->cap ? r->cap * 2 : 4 * BUF_SIZE;
+            r->buf = realloc(r->buf, r->cap + 1);
+        }
+
+        ssize_t n = read(STDIN_FILENO, r->buf + r->len, r->cap - r->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            r->eof = true;
+        else
+            r->len += (size_t)n;
+    }
+}
+
+static void close_fifos(void)
+{
+    if (fd_c2s >= 0)
+        close(fd_c2s);
+    if (fd_s2c >= 0)
+        close(fd_s2c);
+    fd_c2s = fd_s2c = -1;
+}
+
+// Closes a half-open connection and passes `rc` through
+static int handshake_fail(int rc)
+{
+    close_fifos();
+    return rc;
+}
+
+// Connects to the server. With `resume`, local_doc is kept and the server
+// is asked for only the broadcasts since applied_version. On failure the
+// FIFOs are closed and local_doc is untouched, so the caller may retry.
+int client_handshake(bool resume)
 {
     char fifo_c2s[FIFO_NAME_MAX];
     char fifo_s2c[FIFO_NAME_MAX];
@@ -102,11 +354,22 @@ void client_handshake(pid_t server_pid, const char *username)
     sigprocmask(SIG_BLOCK, &set, NULL);
 
     // Send SIGRTMIN to server
-    kill(server_pid, SIGRTMIN);
+    if (kill(server_pid, SIGRTMIN) != 0)
+    {
+        perror("signal server failed");
+        return HANDSHAKE_RETRY;
+    }
 
-    // Wait for SIGRTMIN+1
-    int sig;
-    sigwait(&set, &sig);
+    // Wait for SIGRTMIN+1. A slow server is waited out rather than asked
+    // again, which would leave a second thread on the same FIFOs.
+    while (sigtimedwait(&set, NULL, &(struct timespec){HANDSHAKE_POLL_S, 0}) < 0)
+    {
+        if (kill(server_pid, 0) != 0)
+        {
+            fprintf(stderr, "Server exited before answering\n");
+            return HANDSHAKE_RETRY;
+        }
+    }
 
     // FIFO names
     snprintf(fifo_c2s, sizeof(fifo_c2s), "FIFO_C2S_%d", client_pid);
@@ -117,142 +380,420 @@ void client_handshake(pid_t server_pid, const char *username)
     if (fd_c2s < 0)
     {
         perror("open FIFO_C2S failed");
-        exit(1);
+        return HANDSHAKE_RETRY;
     }
 
     fd_s2c = open(fifo_s2c, O_RDONLY);
     if (fd_s2c < 0)
     {
         perror("open FIFO_S2C failed");
-        close(fd_c2s);
-        exit(1);
+        return handshake_fail(HANDSHAKE_RETRY);
     }
 
-    // Send username
-    dprintf(fd_c2s, "%s\n", username);
+    // Send username and document, asking to map the snapshot rather
+    // than copy it
+    char doc_opt[FIFO_NAME_MAX] = "";
+    if (client_document)
+        snprintf(doc_opt, sizeof(doc_opt), " doc=%s", client_document);
+    if (client_deltas)
+        strncat(doc_opt, " deltas=1", sizeof(doc_opt) - strlen(doc_opt) - 1);
+
+    if (resume)
+    {
+        pthread_mutex_lock(&local_doc_mutex);
+        // A lazily adopted snapshot is only hashed by its first commit
+        uint64_t sum = local_doc->snapshot == local_doc->lazy_base
+                           ? snapshot_checksum(local_doc->snapshot, local_doc->snapshot_len)
+                           : local_doc->snapshot_hash;
+        pthread_mutex_unlock(&local_doc_mutex);
+        dprintf(fd_c2s, "%s%s map=1 since=%llu sum=%016llx\n", client_username, doc_opt,
+                (unsigned long long)applied_version, (unsigned long long)sum);
+    }
+    else
+    {
+        dprintf(fd_c2s, "%s%s map=1\n", client_username, doc_opt);
+    }
 
     // Read role line
     char *role_line = read_line_dynamic(fd_s2c);
     if (!role_line)
     {
         fprintf(stderr, "Failed to read role line\n");
-        cleanup_client();
-        exit(1);
+        return handshake_fail(HANDSHAKE_RETRY);
     }
 
     if (strcmp(role_line, "Reject UNAUTHORISED") == 0)
     {
         fprintf(stderr, "Server rejected user\n");
         free(role_line);
-        cleanup_client();
-        exit(1);
+        return handshake_fail(HANDSHAKE_REJECTED);
+    }
+    else if (strcmp(role_line, "Reject INVALID_DOCUMENT") == 0)
+    {
+        fprintf(stderr, "Server rejected document name\n");
+        free(role_line);
+        return handshake_fail(HANDSHAKE_REJECTED);
     }
 
+    free(permission);
     permission = strdup(role_line);
     free(role_line);
 
-    // Read version and ignore
+    // Read version of the snapshot (or of the end of the delta)
     char *ver_line = read_line_dynamic(fd_s2c);
     if (!ver_line)
     {
         fprintf(stderr, "Failed to read version line\n");
-        cleanup_client();
-        exit(1);
+        return handshake_fail(HANDSHAKE_RETRY);
     }
+    uint64_t version = strtoull(ver_line, NULL, 10);
     free(ver_line);
 
-    // Read document length
+    // Read document length, or a MAP offer for the server's sealed copy
     char *len_line = read_line_dynamic(fd_s2c);
     if (!len_line)
     {
         fprintf(stderr, "Failed to read length line\n");
-        cleanup_client();
-        exit(1);
+        return handshake_fail(HANDSHAKE_RETRY);
     }
-    size_t doc_len = (size_t)strtoull(len_line, NULL, 10);
-    free(len_line);
 
-    // Read document content
-    char *buffer = Calloc(doc_len + 1, sizeof(char));
-    size_t total_read = 0;
-    while (total_read < doc_len)
+    size_t doc_len = 0;
+    size_t mapped = 0; // nonzero: buffer is the server's mapped snapshot
+    char *buffer = NULL;
+    if (strncmp(len_line, "DELTA ", 6) == 0)
     {
-        ssize_t n = read(fd_s2c, buffer + total_read, doc_len - total_read);
-        if (n <= 0)
+        // The missing broadcasts, replayed from the server log
+        size_t delta_len = (size_t)strtoull(len_line + 6, NULL, 10);
+        free(len_line);
+
+        char *delta = Calloc(delta_len + 1, sizeof(char));
+        size_t total_read = 0;
+        while (total_read < delta_len)
+        {
+            ssize_t n = read(fd_s2c, delta + total_read, delta_len - total_read);
+            if (n <= 0)
+            {
+                fprintf(stderr, "Failed to read delta\n");
+                free(delta);
+                return handshake_fail(HANDSHAKE_RETRY);
+            }
+            total_read += n;
+        }
+
+        const char *cursor = delta;
+        const char *end;
+        while ((end = strstr(cursor, "END\n")))
+        {
+            process_broadcast(cursor, end + 4 - cursor);
+            cursor = end + 4;
+        }
+        free(delta);
+
+        pthread_mutex_lock(&local_doc_mutex);
+        local_echo_reset(local_edits);
+        pthread_mutex_unlock(&local_doc_mutex);
+        return HANDSHAKE_OK;
+    }
+    else if (strncmp(len_line, "MAP ", 4) == 0)
+    {
+        buffer = map_server_snapshot(len_line, &doc_len, &mapped);
+        dprintf(fd_c2s, buffer ? "MAPPED\n" : "COPY\n");
+
+        if (!buffer)
+        {
+            free(len_line);
+            len_line = read_line_dynamic(fd_s2c);
+            if (!len_line)
+            {
+                fprintf(stderr, "Failed to read length line\n");
+                return handshake_fail(HANDSHAKE_RETRY);
+            }
+        }
+    }
+
+    if (!buffer)
+    {
+        doc_len = (size_t)strtoull(len_line, NULL, 10);
+
+        // Read document content
+        buffer = Calloc(doc_len + 1, sizeof(char));
+        size_t total_read = 0;
+        while (total_read < doc_len)
         {
-            fprintf(stderr, "Failed to read document content\n");
-            free(buffer);
-            cleanup_client();
-            exit(1);
+            ssize_t n = read(fd_s2c, buffer + total_read, doc_len - total_read);
+            if (n <= 0)
+            {
+                fprintf(stderr, "Failed to read document content\n");
+                free(buffer);
+                free(len_line);
+                return handshake_fail(HANDSHAKE_RETRY);
+            }
+            total_read += n;
         }
-        total_read += n;
+        buffer[doc_len] = '\0';
     }
-    buffer[doc_len] = '\0';
+    free(len_line);
 
-    local_doc = markdown_init();
-    markdown_parse_string(local_doc, buffer);
-    free(buffer);
+    // The buffer becomes the committed snapshot that positions in
+    // later broadcasts are resolved against
+    document *doc = markdown_init();
+    if (client_lazy)
+    {
+        adopt_snapshot_lazily(doc, buffer, doc_len);
+    }
+    else
+    {
+        markdown_parse_string(doc, buffer);
+        doc->snapshot = buffer;
+        doc->snapshot_len = doc_len;
+        index_snapshot(doc);
+        if (mapped) // no spans, so the first commit unmaps it
+            doc->lazy_base = buffer;
+    }
+    doc->lazy_mapped = mapped;
+
+    pthread_mutex_lock(&local_doc_mutex);
+    if (local_doc)
+        markdown_free(local_doc);
+    local_doc = doc;
+    applied_version = version;
+    local_echo_reset(local_edits);
+    pthread_mutex_unlock(&local_doc_mutex);
+    return HANDSHAKE_OK;
 }
 
-void *pipe_listener_thread(void *arg)
+// Maps "MAP <pid> <fd> <len>" through /proc and returns the mapping
+// itself, or NULL if the descriptor is not reachable. The server seals
+// the memfd, so the pages never change under us and the document can
+// keep them as its snapshot until a commit replaces it.
+static char *map_server_snapshot(const char *map_line, size_t *len_out, size_t *mapped_out)
 {
-    (void)arg;
-    char buffer[BUF_SIZE];
-    size_t buf_len = 0;
+    int pid, fd;
+    size_t len;
+    if (sscanf(map_line, "MAP %d %d %zu", &pid, &fd, &len) != 3)
+        return NULL;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, fd);
+    int local_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (local_fd < 0)
+        return NULL;
+
+    // The file carries a trailing '\0' after the document
+    char *view = mmap(NULL, len + 1, PROT_READ, MAP_PRIVATE, local_fd, 0);
+    close(local_fd);
+    if (view == MAP_FAILED)
+        return NULL;
+
+    *len_out = len;
+    *mapped_out = len + 1;
+    return view;
+}
 
-    while (1)
+// Logs one "VERSION ... END\n" broadcast and applies it if it is newer
+// than local_doc. Older ones were covered by the bootstrap, and a tick
+// that did not bump the version changed nothing, but its EDIT lines
+// still settle our held edits. The server's checksum of the new
+// version, when present, must match ours.
+static void process_broadcast(const char *msg, size_t len)
+{
+    uint64_t version = 0;
+    unsigned long long sum = 0;
+    int fields = sscanf(msg, "VERSION %lu %llx", &version, &sum);
+
+    pthread_mutex_lock(&local_log_mutex);
+    client_log_append(local_log, msg, len);
+    pthread_mutex_unlock(&local_log_mutex);
+
+    last_logged_version = version;
+
+    pthread_mutex_lock(&local_doc_mutex);
+    local_echo_ack(local_edits, msg, len, client_username);
+    if (version <= applied_version)
     {
-        ssize_t n = read(fd_s2c, buffer + buf_len, BUF_SIZE - buf_len);
-        if (n <= 0)
+        pthread_mutex_unlock(&local_doc_mutex);
+        return;
+    }
+
+    if (!apply_splices(msg, len))
+        apply_broadcast(msg, len);
+    markdown_increment_version(local_doc);
+    local_echo_rebase(local_edits);
+    applied_version = version;
+    if (fields == 2 && local_doc->snapshot_hash != sum && !resync_pending)
+    {
+        fprintf(stderr, "Local document diverged at version %llu; resyncing\n",
+                (unsigned long long)version);
+        resync_pending = true;
+    }
+    pthread_mutex_unlock(&local_doc_mutex);
+}
+
+// Drops the connection so the listener reconnects for a full snapshot.
+// Nothing narrower is safe: the checksum covers the whole document and
+// cannot say which lines differ, and a delta from an earlier version
+// would need that version's text, which the diverged commit replaced,
+// then run through the same apply that just went wrong. The snapshot
+// arrives mapped rather than copied, and --lazy skips parsing it.
+static void request_resync(void)
+{
+    pthread_mutex_lock(&conn_mutex);
+    if (conn_ready)
+    {
+        dprintf(fd_c2s, "DISCONNECT\n");
+        conn_ready = false;
+    }
+    pthread_mutex_unlock(&conn_mutex);
+}
+
+// Splits the server's stream into "VERSION ... END\n" broadcasts. Bytes
+// are scanned once: `scan` remembers where the last read stopped, and a
+// broadcast of any size accumulates until its END line arrives.
+typedef struct frame_reader
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t start; // first byte of the broadcast being assembled
+    size_t line;  // first byte of the line being scanned
+    size_t scan;  // first byte not yet scanned
+} frame_reader;
+
+static ssize_t frame_reader_fill(frame_reader *r, int fd)
+{
+    // Drop what has been dispatched, then make room for a full read
+    if (r->start > 0)
+    {
+        memmove(r->buf, r->buf + r->start, r->len - r->start);
+        r->len -= r->start;
+        r->line -= r->start;
+        r->scan -= r->start;
+        r->start = 0;
+    }
+    if (r->cap - r->len < BUF_SIZE)
+    {
+        r->cap = r->cap ? r->cap * 2 : BUF_SIZE;
+        r->buf = realloc(r->buf, r->cap + 1);
+    }
+
+    ssize_t n = read(fd, r->buf + r->len, r->cap - r->len);
+    if (n > 0)
+    {
+        r->len += (size_t)n;
+        r->buf[r->len] = '\0'; // lets process_broadcast() sscanf the header
+    }
+    return n;
+}
+
+// Next complete broadcast, pointing into the reader's buffer; valid
+// until the next fill
+static bool frame_reader_next(frame_reader *r, const char **msg, size_t *len)
+{
+    while (r->scan < r->len)
+    {
+        char *nl = memchr(r->buf + r->scan, '\n', r->len - r->scan);
+        if (!nl)
         {
+            r->scan = r->len;
             break;
         }
 
-        buf_len += n;
-        buffer[buf_len] = '\0';
-
-        // Wait until END\n to process broadcast
-        char *end_ptr = strstr(buffer, "END\n");
-        if (!end_ptr)
-            continue;
-
-        size_t full_len = end_ptr - buffer + 4;
+        size_t line = r->line;
+        r->scan = r->line = (size_t)(nl - r->buf) + 1;
+        if (r->line - line == 4 && memcmp(r->buf + line, "END\n", 4) == 0)
+        {
+            *msg = r->buf + r->start;
+            *len = r->line - r->start;
+            r->start = r->line;
+            return true;
+        }
+    }
+    return false;
+}
 
-        // Extract broadcast string
-        char *broadcast = Calloc(full_len + 1, sizeof(char));
-        memcpy(broadcast, buffer, full_len);
-        broadcast[full_len] = '\0';
+static void frame_reader_reset(frame_reader *r)
+{
+    r->len = r->start = r->line = r->scan = 0;
+}
 
-        // Get version number from start of broadcast
-        uint64_t version = 0;
-        sscanf(broadcast, "VERSION %lu", &version);
+// Connects again after the stream ended, retrying failed handshakes with
+// backoff. Runs without conn_mutex, so senders keep waiting on conn_cond
+// rather than on the lock. -1 once we asked to leave, the server is gone
+// or it turned us away.
+static int reconnect(void)
+{
+    long backoff_ms = 50;
+    while (1)
+    {
+        pthread_mutex_lock(&conn_mutex);
+        bool leaving = disconnecting;
+        pthread_mutex_unlock(&conn_mutex);
+        if (leaving || kill(server_pid, 0) != 0)
+            return -1;
+
+        close_fifos();
+        int rc = client_handshake(!resync_pending);
+        if (rc == HANDSHAKE_OK)
+        {
+            resync_pending = false;
+            return 0;
+        }
+        if (rc == HANDSHAKE_REJECTED)
+            return -1;
 
-       
-        
-            pthread_mutex_lock(&local_log_mutex);
-            size_t old_log_len = local_log ? strlen(local_log) : 0;
-            local_log = realloc(local_log, old_log_len + full_len + 1);
-            memcpy(local_log + old_log_len, broadcast, full_len);
-            local_log[old_log_len + full_len] = '\0';
-            pthread_mutex_unlock(&local_log_mutex);
+        nanosleep(&(struct timespec){backoff_ms / 1000, backoff_ms % 1000 * 1000000L}, NULL);
+        backoff_ms = backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS ? backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+    }
+}
 
-            last_logged_version = version;
-        
+void *pipe_listener_thread(void *arg)
+{
+    (void)arg;
+    frame_reader reader = {0};
 
-        pthread_mutex_lock(&local_doc_mutex);
-        apply_broadcast(broadcast);
-        markdown_increment_version(local_doc);
-        pthread_mutex_unlock(&local_doc_mutex);
+    while (1)
+    {
+        if (resync_pending)
+            request_resync();
 
-        // Shift remainder of buffer
-        size_t leftover = buf_len - full_len;
-        memmove(buffer, buffer + full_len, leftover);
-        buf_len = leftover;
-        buffer[buf_len] = '\0';
+        ssize_t n = frame_reader_fill(&reader, fd_s2c);
+        if (n <= 0)
+        {
+            pthread_mutex_lock(&conn_mutex);
+            conn_ready = false;
+            pthread_mutex_unlock(&conn_mutex);
+
+            bool resumed = reconnect() == 0;
+            pthread_mutex_lock(&conn_mutex);
+            if (resumed)
+            {
+                // A DISCONNECT typed while we were away was not sent
+                if (disconnecting)
+                    dprintf(fd_c2s, "DISCONNECT\n");
+                conn_ready = true;
+            }
+            else
+            {
+                conn_closed = true;
+            }
+            pthread_cond_broadcast(&conn_cond);
+            pthread_mutex_unlock(&conn_mutex);
+
+            if (!resumed)
+                break;
+            frame_reader_reset(&reader);
+            continue;
+        }
 
-        free(broadcast);
+        // Process every complete broadcast; a backlog flush can deliver
+        // several in one read
+        const char *msg;
+        size_t len;
+        while (frame_reader_next(&reader, &msg, &len))
+            process_broadcast(msg, len);
     }
 
+    free(reader.buf);
     return NULL;
 }
 
@@ -265,8 +806,9 @@ void cleanup_client(void)
         close(fd_s2c);
     if (permission)
         free(permission);
-    if (local_log)
-        free(local_log);
+    client_log_free(local_log);
+    local_echo_free(local_edits);
+    free(outbox);
     if (local_doc)
         markdown_free(local_doc);
 }
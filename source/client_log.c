@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client_log.h"
+#include "ipc_helpers.h"
+#include "memory.h"
+
+client_log *client_log_create(size_t mem_cap)
+{
+    client_log *log = Calloc(1, sizeof(client_log));
+    log->blocks = create_array(16);
+    log->mem_cap = mem_cap;
+    log->spill_fd = -1;
+    return log;
+}
+
+void client_log_free(client_log *log)
+{
+    if (!log)
+        return;
+    free_array(log->blocks);
+    if (log->spill_fd >= 0)
+        close(log->spill_fd);
+    free(log);
+}
+
+static int open_spill_file(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/client_log.XXXXXX", dir && *dir ? dir : "/tmp");
+
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path); // gone with the process
+    return fd;
+}
+
+// Moves the oldest full blocks to the spill file until memory is back
+// under the cap. On failure the cap is dropped and the log stays whole.
+static void spill_blocks(client_log *log)
+{
+    while (log->blocks->size > 1 && log->blocks->size * CLIENT_LOG_BLOCK > log->mem_cap)
+    {
+        if (log->spill_fd < 0 && (log->spill_fd = open_spill_file()) < 0)
+            goto fail;
+
+        char *block = get_from(log->blocks, 0);
+        if (write_all(log->spill_fd, block, CLIENT_LOG_BLOCK) != 0)
+            goto fail;
+
+        free(remove_at(log->blocks, 0));
+        log->spilled_len += CLIENT_LOG_BLOCK;
+    }
+    return;
+
+fail:
+    perror("client log spill");
+    log->mem_cap = 0;
+}
+
+void client_log_append(client_log *log, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (log->blocks->size == 0 || log->tail_len == CLIENT_LOG_BLOCK)
+        {
+            append_to(log->blocks, Calloc(CLIENT_LOG_BLOCK, sizeof(char)));
+            log->tail_len = 0;
+            if (log->mem_cap)
+                spill_blocks(log);
+        }
+
+        char *tail = get_from(log->blocks, log->blocks->size - 1);
+        size_t n = CLIENT_LOG_BLOCK - log->tail_len;
+        if (n > len)
+            n = len;
+        memcpy(tail + log->tail_len, data, n);
+
+        log->tail_len += n;
+        log->total_len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+int client_log_write(const client_log *log, FILE *out)
+{
+    char buf[CLIENT_LOG_BLOCK];
+    for (uint64_t off = 0; off < log->spilled_len;)
+    {
+        ssize_t n = pread(log->spill_fd, buf, sizeof(buf), (off_t)off);
+        if (n <= 0 || fwrite(buf, 1, (size_t)n, out) != (size_t)n)
+            return -1;
+        off += (uint64_t)n;
+    }
+
+    for (size_t i = 0; i < log->blocks->size; i++)
+    {
+        size_t n = i + 1 == log->blocks->size ? log->tail_len : CLIENT_LOG_BLOCK;
+        if (fwrite(get_from(log->blocks, i), 1, n, out) != n)
+            return -1;
+    }
+    return 0;
+}
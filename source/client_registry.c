@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include "client_registry.h"
+#include "memory.h"
+
+#define NO_SLOT UINT32_MAX
+
+static uint32_t handle_slot(client_handle h)
+{
+    return (uint32_t)h;
+}
+
+static uint32_t handle_generation(client_handle h)
+{
+    return (uint32_t)(h >> 32);
+}
+
+client_registry *client_registry_create(void)
+{
+    client_registry *r = Calloc(1, sizeof(client_registry));
+    pthread_mutex_init(&r->lock, NULL);
+    rcu_init(&r->rcu);
+    r->free_head = NO_SLOT;
+    atomic_init(&r->count, 0);
+    atomic_init(&r->epoch, 0);
+    return r;
+}
+
+void client_registry_free(client_registry *r, void (*free_client)(client_info *))
+{
+    if (!r)
+        return;
+
+    for (uint32_t i = 0; i < r->cap; i++)
+    {
+        if (r->slots[i].client && free_client)
+            free_client(r->slots[i].client);
+    }
+
+    pthread_mutex_destroy(&r->lock);
+    rcu_destroy(&r->rcu);
+    free(r->slots);
+    free(r->iter);
+    free(r);
+}
+
+client_handle client_registry_add(client_registry *r, client_info *c)
+{
+    pthread_mutex_lock(&r->lock);
+    if (r->free_head == NO_SLOT)
+    {
+        // Grow and thread the new slots onto the free list
+        uint32_t cap = r->cap ? r->cap * 2 : 16;
+        client_slot *slots = Calloc(cap, sizeof(client_slot));
+        for (uint32_t i = 0; i < r->cap; i++)
+            slots[i] = r->slots[i];
+        for (uint32_t i = r->cap; i < cap; i++)
+            slots[i].next_free = i + 1 < cap ? i + 1 : NO_SLOT;
+        free(r->slots);
+        r->slots = slots;
+        r->free_head = r->cap;
+        r->cap = cap;
+    }
+
+    uint32_t idx = r->free_head;
+    client_slot *slot = &r->slots[idx];
+    r->free_head = slot->next_free;
+    slot->client = c;
+
+    atomic_fetch_add(&r->count, 1);
+    atomic_fetch_add(&r->epoch, 1);
+    client_handle h = (client_handle)slot->generation << 32 | idx;
+    pthread_mutex_unlock(&r->lock);
+    return h;
+}
+
+client_info *client_registry_remove(client_registry *r, client_handle h)
+{
+    uint32_t idx = handle_slot(h);
+
+    pthread_mutex_lock(&r->lock);
+    client_info *c = NULL;
+    if (idx < r->cap && r->slots[idx].client &&
+        r->slots[idx].generation == handle_generation(h))
+    {
+        client_slot *slot = &r->slots[idx];
+        c = slot->client;
+        slot->client = NULL;
+        slot->generation++;
+        slot->next_free = r->free_head;
+        r->free_head = idx;
+
+        atomic_fetch_sub(&r->count, 1);
+        atomic_fetch_add(&r->epoch, 1);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    // A pass that began before the epoch moved may still hold `c`, on
+    // either reader slot; the grace period waits out both, so the caller
+    // can free `c` without the broadcaster writing to a recycled client
+    if (c)
+        rcu_synchronize(&r->rcu);
+    return c;
+}
+
+client_info *client_registry_get(client_registry *r, client_handle h)
+{
+    uint32_t idx = handle_slot(h);
+
+    pthread_mutex_lock(&r->lock);
+    client_info *c = NULL;
+    if (idx < r->cap && r->slots[idx].generation == handle_generation(h))
+        c = r->slots[idx].client;
+    pthread_mutex_unlock(&r->lock);
+    return c;
+}
+
+size_t client_registry_count(client_registry *r)
+{
+    return atomic_load(&r->count);
+}
+
+void client_registry_for_each(client_registry *r, void (*fn)(client_info *, void *), void *arg)
+{
+    pthread_mutex_lock(&r->lock);
+    for (uint32_t i = 0; i < r->cap; i++)
+    {
+        if (r->slots[i].client)
+            fn(r->slots[i].client, arg);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+void client_registry_iter_begin(client_registry *r, client_iter *it)
+{
+    it->rcu_slot = rcu_read_lock(&r->rcu);
+
+    // Checked inside the read section: a removal that this misses has
+    // to wait for us in rcu_synchronize()
+    uint64_t epoch = atomic_load(&r->epoch);
+    if (epoch != r->iter_epoch)
+    {
+        pthread_mutex_lock(&r->lock);
+        if (r->iter_cap < r->cap)
+        {
+            free(r->iter);
+            r->iter_cap = r->cap;
+            r->iter = Calloc(r->iter_cap, sizeof(client_info *));
+        }
+        r->iter_count = 0;
+        for (uint32_t i = 0; i < r->cap; i++)
+        {
+            if (r->slots[i].client)
+                r->iter[r->iter_count++] = r->slots[i].client;
+        }
+        r->iter_epoch = atomic_load(&r->epoch);
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    it->clients = r->iter;
+    it->count = r->iter_count;
+}
+
+void client_registry_iter_end(client_registry *r, client_iter *it)
+{
+    rcu_read_unlock(&r->rcu, it->rcu_slot);
+    it->clients = NULL;
+    it->count = 0;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include "cmd_queue.h"
+#include "memory.h"
+
+typedef struct
+{
+    cmd_ipc *cmd;
+    size_t run;
+    size_t idx;
+} heap_entry;
+
+cmd_queue *cmd_queue_create(void)
+{
+    cmd_queue *q = Calloc(1, sizeof(cmd_queue));
+    cmd_node *stub = Calloc(1, sizeof(cmd_node));
+    atomic_init(&stub->next, NULL);
+    q->head = stub;
+    q->tail = stub;
+    atomic_init(&q->closed, false);
+    return q;
+}
+
+void cmd_queue_free(cmd_queue *q)
+{
+    if (!q)
+        return;
+
+    cmd_ipc *c;
+    while ((c = cmd_queue_pop(q)) != NULL)
+    {
+        free_cmd_ipc(c);
+        free(c);
+    }
+    free(q->head);
+    free(q);
+}
+
+// === Producer side ===
+void cmd_queue_push(cmd_queue *q, cmd_ipc *cmd)
+{
+    cmd_node *node = Calloc(1, sizeof(cmd_node));
+    node->cmd = cmd;
+    atomic_init(&node->next, NULL);
+
+    atomic_store_explicit(&q->tail->next, node, memory_order_release);
+    q->tail = node;
+}
+
+void cmd_queue_close(cmd_queue *q)
+{
+    atomic_store_explicit(&q->closed, true, memory_order_release);
+}
+
+// === Consumer side ===
+cmd_ipc *cmd_queue_pop(cmd_queue *q)
+{
+    cmd_node *next = atomic_load_explicit(&q->head->next, memory_order_acquire);
+    if (!next)
+        return NULL;
+
+    // `next` becomes the new stub once its payload is taken
+    cmd_ipc *cmd = next->cmd;
+    next->cmd = NULL;
+    free(q->head);
+    q->head = next;
+    return cmd;
+}
+
+bool cmd_queue_is_closed(cmd_queue *q)
+{
+    return atomic_load_explicit(&q->closed, memory_order_acquire);
+}
+
+// === k-way merge ===
+static int cmd_earlier(const cmd_ipc *a, const cmd_ipc *b)
+{
+    if (a->timestamp.tv_sec != b->timestamp.tv_sec)
+        return a->timestamp.tv_sec < b->timestamp.tv_sec;
+    if (a->timestamp.tv_usec != b->timestamp.tv_usec)
+        return a->timestamp.tv_usec < b->timestamp.tv_usec;
+    return a->seq < b->seq;
+}
+
+static void heap_sift_down(heap_entry *heap, size_t n, size_t i)
+{
+    while (1)
+    {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < n && cmd_earlier(heap[l].cmd, heap[min].cmd))
+            min = l;
+        if (r < n && cmd_earlier(heap[r].cmd, heap[min].cmd))
+            min = r;
+        if (min == i)
+            return;
+        heap_entry tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+size_t cmd_queue_merge(array_list *queues, array_list *carry, array_list *out)
+{
+    size_t k = queues->size;
+    if (k == 0 && (!carry || carry->size == 0))
+        return 0;
+
+    // 1. Take a cut of every queue. Each run is already in arrival order.
+    //    Commands carried over from the last tick are one more run.
+    array_list **runs = Calloc(k + 1, sizeof(array_list *));
+    heap_entry *heap = Calloc(k + 1, sizeof(heap_entry));
+    size_t n = 0, total = 0;
+
+    if (carry && carry->size)
+    {
+        runs[k] = create_array(carry->size);
+        for (size_t i = 0; i < carry->size; i++)
+            append_to(runs[k], get_from(carry, i));
+        carry->size = 0;
+        heap[n++] = (heap_entry){get_from(runs[k], 0), k, 0};
+        total += runs[k]->size;
+    }
+
+    for (size_t i = 0; i < k; i++)
+    {
+        cmd_queue *q = get_from(queues, i);
+        cmd_ipc *c;
+        while ((c = cmd_queue_pop(q)) != NULL)
+        {
+            if (!runs[i])
+                runs[i] = create_array(16);
+            append_to(runs[i], c);
+        }
+        if (runs[i])
+        {
+            heap[n++] = (heap_entry){get_from(runs[i], 0), i, 0};
+            total += runs[i]->size;
+        }
+    }
+
+    // 2. Heapify and merge
+    for (size_t i = n / 2; i-- > 0;)
+        heap_sift_down(heap, n, i);
+
+    while (n > 0)
+    {
+        append_to(out, heap[0].cmd);
+
+        array_list *run = runs[heap[0].run];
+        if (++heap[0].idx < run->size)
+            heap[0].cmd = get_from(run, heap[0].idx);
+        else
+            heap[0] = heap[--n];
+
+        heap_sift_down(heap, n, 0);
+    }
+
+    // 3. Runs only borrowed the commands
+    for (size_t i = 0; i <= k; i++)
+    {
+        if (runs[i])
+        {
+            free(runs[i]->data);
+            free(runs[i]);
+        }
+    }
+    free(runs);
+    free(heap);
+
+    return total;
+}
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "doc_registry.h"
+#include "client_registry.h"
+#include "cmd_queue.h"
+#include "hash_map.h"
+#include "ipc_helpers.h"
+#include "log_index.h"
+#include "markdown.h"
+#include "memory.h"
+#include "segment_log.h"
+#include "server_config.h"
+#include "snapshot_share.h"
+#include "stats.h"
+#include "throttle.h"
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hash_map *docs_by_name = NULL;
+static array_list *docs = NULL;
+static hosted_doc *default_doc = NULL;
+
+// Names become file and directory names, so keep them to a safe alphabet
+static bool doc_name_valid(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > DOC_NAME_MAX)
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char ch = (unsigned char)name[i];
+        if (!isalnum(ch) && ch != '_' && ch != '-')
+            return false;
+    }
+    return true;
+}
+
+// A steady stream of readers must not starve the tick
+static void init_writer_preferring(pthread_rwlock_t *lock)
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+// Takes ownership of the document's snapshot and line index; the engine
+// keeps reading them until its next commit
+static doc_view *view_create(document *doc, uint64_t version, uint64_t checksum)
+{
+    doc_view *v = Calloc(1, sizeof(doc_view));
+    atomic_init(&v->refs, 1); // the document's reference
+    v->version = version;
+    v->checksum = checksum;
+    v->data = doc->snapshot ? doc->snapshot : Calloc(1, sizeof(char));
+    v->len = doc->snapshot_len;
+    v->line_marks = doc->line_marks;
+    v->marks = doc->snapshot_marks;
+    return v;
+}
+
+static void free_client_info(client_info *c)
+{
+    pthread_mutex_destroy(&c->lock);
+    free(c->username);
+    free(c->permission);
+    free(c->backlog);
+    free(c);
+}
+
+static hosted_doc *hosted_doc_create(const char *name, const char *log_dir)
+{
+    segment_log *log = segment_log_open(log_dir, config.log_segment_size, config.log_retain);
+    if (!log)
+        return NULL;
+
+    hosted_doc *d = Calloc(1, sizeof(hosted_doc));
+    d->name = strdup(name);
+    d->path = Calloc(strlen(name) + 4, sizeof(char));
+    sprintf(d->path, "%s.md", name);
+
+    d->doc = markdown_init();
+    d->version = 1;
+    d->checksum = snapshot_checksum("", 0);
+
+    d->view = view_create(d->doc, d->version, d->checksum);
+    init_writer_preferring(&d->view_lock);
+    pthread_mutex_init(&d->snapshot_cache_mutex, NULL);
+
+    d->clients = client_registry_create();
+
+    d->cmd_queues = create_array(8);
+    pthread_mutex_init(&d->cmd_queue_mutex, NULL);
+    d->cmd_list = create_array(16);
+    d->cmd_carry = create_array(16);
+    d->throttle = throttle_create();
+
+    d->log = log;
+    d->log_index = log_index_create(config.log_user_index);
+    init_writer_preferring(&d->log_lock);
+    d->log_offset = UINT64_MAX;
+    atomic_init(&d->delta_clients, 0);
+
+    d->stats = Calloc(1, sizeof(doc_stats));
+
+    return d;
+}
+
+static void hosted_doc_free(hosted_doc *d)
+{
+    d->doc->snapshot = NULL; // owned by the view
+    d->doc->line_marks = NULL;
+    markdown_free(d->doc);
+    doc_view_release(d->view);
+    shared_snapshot_reset(&d->snapshot_cache);
+
+    for (size_t i = 0; i < d->cmd_list->size; i++)
+        free_cmd_ipc(get_from(d->cmd_list, i));
+    free_array(d->cmd_list);
+    for (size_t i = 0; i < d->cmd_carry->size; i++)
+        free_cmd_ipc(get_from(d->cmd_carry, i));
+    free_array(d->cmd_carry);
+    throttle_free(d->throttle);
+    free(d->stats);
+
+    for (size_t i = 0; i < d->cmd_queues->size; i++)
+        cmd_queue_free(get_from(d->cmd_queues, i));
+    d->cmd_queues->size = 0;
+    free_array(d->cmd_queues);
+
+    client_registry_free(d->clients, free_client_info);
+
+    segment_log_close(d->log);
+    log_index_free(d->log_index);
+    free(d->log_entry);
+    free(d->delta_entry);
+
+    pthread_rwlock_destroy(&d->view_lock);
+    pthread_mutex_destroy(&d->snapshot_cache_mutex);
+    pthread_mutex_destroy(&d->cmd_queue_mutex);
+    pthread_rwlock_destroy(&d->log_lock);
+    free(d->name);
+    free(d->path);
+    free(d);
+}
+
+int doc_registry_init(void)
+{
+    docs_by_name = hash_map_create(16);
+    docs = create_array(16);
+
+    // The default document keeps the log directory's top level
+    default_doc = hosted_doc_create(DEFAULT_DOC_NAME, config.log_dir);
+    if (!default_doc)
+        return -1;
+
+    hash_map_put(docs_by_name, default_doc->name, default_doc);
+    append_to(docs, default_doc);
+    return 0;
+}
+
+hosted_doc *doc_registry_open(const char *name)
+{
+    if (!name)
+        return default_doc;
+    if (!doc_name_valid(name))
+        return NULL;
+
+    pthread_mutex_lock(&registry_mutex);
+    hosted_doc *d = hash_map_get(docs_by_name, name);
+    if (!d && (!config.max_docs || docs->size < config.max_docs))
+    {
+        char *dir = Calloc(strlen(config.log_dir) + strlen(name) + 2, sizeof(char));
+        sprintf(dir, "%s/%s", config.log_dir, name);
+        d = hosted_doc_create(name, dir);
+        free(dir);
+
+        if (d)
+        {
+            hash_map_put(docs_by_name, d->name, d);
+            append_to(docs, d);
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return d;
+}
+
+hosted_doc *doc_registry_find(const char *name)
+{
+    pthread_mutex_lock(&registry_mutex);
+    hosted_doc *d = hash_map_get(docs_by_name, name);
+    pthread_mutex_unlock(&registry_mutex);
+    return d;
+}
+
+hosted_doc *doc_registry_default(void)
+{
+    return default_doc;
+}
+
+void doc_registry_list(array_list *out)
+{
+    pthread_mutex_lock(&registry_mutex);
+    for (size_t i = 0; i < docs->size; i++)
+        append_to(out, get_from(docs, i));
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+void doc_registry_free(void)
+{
+    if (!docs)
+        return;
+
+    hash_map_free(docs_by_name, NULL);
+    docs_by_name = NULL;
+    for (size_t i = 0; i < docs->size; i++)
+        hosted_doc_free(get_from(docs, i));
+    docs->size = 0;
+    free_array(docs);
+    docs = NULL;
+    default_doc = NULL;
+}
+
+// === Published views ===
+
+void hosted_doc_publish(hosted_doc *d)
+{
+    doc_view *v = view_create(d->doc, d->version, d->checksum);
+
+    pthread_rwlock_wrlock(&d->view_lock);
+    doc_view *old = d->view;
+    d->view = v;
+    pthread_rwlock_unlock(&d->view_lock);
+
+    doc_view_release(old);
+}
+
+doc_view *doc_view_acquire(hosted_doc *d)
+{
+    pthread_rwlock_rdlock(&d->view_lock);
+    doc_view *v = d->view;
+    atomic_fetch_add(&v->refs, 1);
+    pthread_rwlock_unlock(&d->view_lock);
+    return v;
+}
+
+void doc_view_release(doc_view *v)
+{
+    if (v && atomic_fetch_sub(&v->refs, 1) == 1)
+    {
+        free(v->data);
+        free(v->line_marks);
+        free(v);
+    }
+}
@@ -2,6 +2,7 @@
 #include "markdown.h"
 #include "memory.h"
 #include "naive_ops.h"
+#include "trace.h"
 
 // === NAIVE OPS HELPERS ===
 
@@ -13,6 +14,19 @@ void update_meta_log(array_list *meta_positions, size_t snapshot_pos, int offset
     append_to(meta_positions, m);
 }
 
+void record_splice(document *doc, size_t pos, size_t del, const char *text, size_t len)
+{
+    if (!doc->splices)
+        return;
+
+    text_splice *s = Calloc(1, sizeof(text_splice) + len);
+    s->pos = pos;
+    s->del = del;
+    s->len = len;
+    memcpy(s->text, text, len);
+    append_to(doc->splices, s);
+}
+
 range *clamp_to_valid(document *doc, size_t pos)
 {
     if (!doc || pos > doc->snapshot_len)
@@ -50,30 +64,308 @@ size_t map_snapshot_to_working(array_list *meta_log, size_t clamped_snapshot_pos
     return (result < 0) ? 0 : (size_t)result;
 }
 
+// === Content hash ===
+
+#define TEXT_HASH_MOD ((1ULL << 61) - 1)
+
+static uint64_t hash_mul(uint64_t a, uint64_t b)
+{
+    __uint128_t p = (__uint128_t)a * b;
+    uint64_t r = (uint64_t)(p & TEXT_HASH_MOD) + (uint64_t)(p >> 61);
+    return r >= TEXT_HASH_MOD ? r - TEXT_HASH_MOD : r;
+}
+
+static uint64_t hash_add(uint64_t a, uint64_t b)
+{
+    uint64_t r = a + b;
+    return r >= TEXT_HASH_MOD ? r - TEXT_HASH_MOD : r;
+}
+
+// Bytes count from 1 so leading NULs still change the hash
+uint64_t text_hash(const char *text, size_t len, uint64_t *pow_out)
+{
+    uint64_t h = 0;
+    for (size_t i = 0; i < len; i++)
+        h = hash_add(hash_mul(h, TEXT_HASH_BASE), (unsigned char)text[i] + 1);
+
+    if (pow_out)
+    {
+        uint64_t pow = 1, base = TEXT_HASH_BASE;
+        for (size_t e = len; e; e >>= 1, base = hash_mul(base, base))
+            if (e & 1)
+                pow = hash_mul(pow, base);
+        *pow_out = pow;
+    }
+    return h;
+}
+
+// Appends a chunk to the hash `h` of everything before it. Only chunks
+// edited since they were last folded are rehashed.
+static uint64_t fold_chunk_hash(uint64_t h, Chunk *c)
+{
+    if (!c->hashed)
+    {
+        c->hash = text_hash(c->text, c->len, &c->hash_pow);
+        c->hashed = true;
+    }
+    return hash_add(hash_mul(h, c->hash_pow), c->hash);
+}
+
+// Equals text_hash() of the flattened document
+uint64_t document_hash(document *doc)
+{
+    uint64_t h = 0;
+    for (Chunk *c = doc->head; c; c = c->next)
+        h = fold_chunk_hash(h, c);
+    return h;
+}
+
 // === NAIVE DOC-STRUCTURE HELPERS ===
 // === Document helpers ===
 
+// One mark per chunk, so the line index comes from the same walk; a
+// span's lines are found by scanning from its mark
+static line_mark *alloc_line_marks(document *doc)
+{
+    free(doc->line_marks);
+    doc->line_marks = Calloc(doc->num_chunks + 1, sizeof(line_mark));
+    doc->snapshot_marks = doc->num_chunks + 1;
+    return doc->line_marks;
+}
+
 char *flatten_document(document *doc)
 {
-    if (!doc || !doc->head)
+    if (!doc)
         return Calloc(1, sizeof(char));
 
+    TRACE_BEGIN("flatten_document");
     size_t total = doc->num_characters;
     char *buf = Calloc(total + 1, sizeof(char)); // +1 for '\0'
     char *p = buf;
+    line_mark *marks = alloc_line_marks(doc);
 
     Chunk *curr = doc->head;
+    uint64_t h = 0;
+    size_t line = 0, spans = 0;
     while (curr)
     {
+        *marks++ = (line_mark){(size_t)(p - buf), line};
         memcpy(p, curr->text, curr->len);
         p += curr->len;
+        h = fold_chunk_hash(h, curr);
+        if (curr->type == LAZY_SPAN)
+        {
+            line += curr->lines;
+            spans++;
+        }
+        else
+            line++;
         curr = curr->next;
     }
+    *marks = (line_mark){total, line};
+    doc->snapshot_lines = line;
+    doc->snapshot_hash = h;
+    doc->lazy_spans = spans;
 
     *p = '\0';
+    TRACE_END("flatten_document");
     return buf;
 }
 
+void index_snapshot(document *doc)
+{
+    line_mark *marks = alloc_line_marks(doc);
+    size_t off = 0, line = 0;
+    uint64_t h = 0;
+    for (Chunk *c = doc->head; c; c = c->next)
+    {
+        *marks++ = (line_mark){off, line++};
+        off += c->len;
+        h = fold_chunk_hash(h, c);
+    }
+    *marks = (line_mark){off, doc->num_chunks};
+    doc->snapshot_lines = doc->num_chunks;
+    doc->snapshot_hash = h;
+}
+
+void infer_chunk_type(const char *line, size_t len, chunk_type *type_out, int *index_OL_out)
+{
+    *type_out = PLAIN;
+    *index_OL_out = 0;
+
+    if (len == 4 && strncmp(line, "---\n", 4) == 0)
+        *type_out = HORIZONTAL_RULE;
+    else if (len >= 2 && line[0] == '>' && line[1] == ' ')
+        *type_out = BLOCKQUOTE;
+    else if (len >= 2 && line[0] == '-' && line[1] == ' ')
+        *type_out = UNORDERED_LIST_ITEM;
+    else if (len >= 2 && line[0] == '#' && line[1] == ' ')
+        *type_out = HEADING1;
+    else if (len >= 3 && line[0] == '#' && line[1] == '#' && line[2] == ' ')
+        *type_out = HEADING2;
+    else if (len >= 4 && line[0] == '#' && line[1] == '#' && line[2] == '#' && line[3] == ' ')
+        *type_out = HEADING3;
+    else if (len >= 3 && line[1] == '.' && line[2] == ' ' && line[0] >= '1' && line[0] <= '9') {
+        *type_out = ORDERED_LIST_ITEM;
+        *index_OL_out = line[0] - '0';
+    }
+}
+
+// === Lazy spans ===
+
+#define LAZY_SPAN_BYTES (64 * 1024)
+
+static size_t count_lines(const char *text, size_t len)
+{
+    size_t n = 0;
+    for (const char *p = text, *end = text + len; (p = memchr(p, '\n', (size_t)(end - p))); p++)
+        n++;
+    return len && text[len - 1] != '\n' ? n + 1 : n;
+}
+
+static Chunk *new_span(const char *text, size_t len, size_t lines)
+{
+    Chunk *span = Calloc(1, sizeof(Chunk));
+    init_chunk(span, LAZY_SPAN, len, 0, (char *)text, 0, NULL, NULL);
+    span->lines = lines;
+    return span;
+}
+
+// Puts `c` between `prev` and `next`
+static void link_between(document *doc, Chunk *c, Chunk *prev, Chunk *next)
+{
+    c->previous = prev;
+    c->next = next;
+    if (prev)
+        prev->next = c;
+    else
+        doc->head = c;
+    if (next)
+        next->previous = c;
+    else
+        doc->tail = c;
+}
+
+void adopt_snapshot_lazily(document *doc, char *snapshot, size_t len)
+{
+    doc->snapshot = doc->lazy_base = snapshot;
+    doc->snapshot_len = len;
+
+    // Spans of about LAZY_SPAN_BYTES, cut after a newline
+    for (size_t off = 0; off < len;)
+    {
+        size_t end = off + LAZY_SPAN_BYTES < len ? off + LAZY_SPAN_BYTES : len;
+        const char *nl = memchr(snapshot + end - 1, '\n', len - (end - 1));
+        end = nl ? (size_t)(nl - snapshot) + 1 : len;
+
+        Chunk *span = new_span(snapshot + off, end - off, count_lines(snapshot + off, end - off));
+        link_between(doc, span, doc->tail, NULL);
+        doc->num_chunks++;
+        doc->num_characters += span->len;
+        doc->lazy_spans++;
+        off = end;
+    }
+
+    line_mark *marks = alloc_line_marks(doc);
+    size_t off = 0, line = 0;
+    for (Chunk *c = doc->head; c; c = c->next)
+    {
+        *marks++ = (line_mark){off, line};
+        off += c->len;
+        line += c->lines;
+    }
+    *marks = (line_mark){off, line};
+    doc->snapshot_lines = line;
+}
+
+bool span_has_ordered_item(const Chunk *span)
+{
+    for (size_t start = 0; start < span->len;)
+    {
+        const char *nl = memchr(span->text + start, '\n', span->len - start);
+        size_t end = nl ? (size_t)(nl - span->text) + 1 : span->len;
+        chunk_type type;
+        int index_OL;
+        infer_chunk_type(span->text + start, end - start, &type, &index_OL);
+        if (type == ORDERED_LIST_ITEM)
+            return true;
+        start = end;
+    }
+    return false;
+}
+
+// Parses the line holding byte `*local` of `span` into a chunk of its
+// own, leaving spans for the lines before and after it. `*local` ends
+// up relative to the returned line; the end of the span counts as the
+// end of its last line.
+static Chunk *materialize_line(document *doc, Chunk *span, size_t *local)
+{
+    const char *text = span->text;
+    size_t probe = *local < span->len ? *local : span->len - 1;
+    size_t start = probe;
+    while (start > 0 && text[start - 1] != '\n')
+        start--;
+    const char *nl = memchr(text + probe, '\n', span->len - probe);
+    size_t end = nl ? (size_t)(nl - text) + 1 : span->len;
+
+    size_t len = end - start;
+    size_t cap = calculate_cap(len + 1);
+    char *owned = Calloc(cap, sizeof(char));
+    memcpy(owned, text + start, len);
+    chunk_type type;
+    int index_OL;
+    infer_chunk_type(owned, len, &type, &index_OL);
+    Chunk *line = Calloc(1, sizeof(Chunk));
+    init_chunk(line, type, len, cap, owned, index_OL, NULL, NULL);
+
+    Chunk *prev = span->previous, *next = span->next;
+    size_t lines_before = start ? count_lines(text, start) : 0;
+    doc->num_chunks--;
+    doc->lazy_spans--;
+
+    if (start > 0)
+    {
+        Chunk *before = new_span(text, start, lines_before);
+        link_between(doc, before, prev, next);
+        prev = before;
+        doc->num_chunks++;
+        doc->lazy_spans++;
+    }
+    link_between(doc, line, prev, next);
+    doc->num_chunks++;
+    if (end < span->len)
+    {
+        Chunk *after = new_span(text + end, span->len - end, span->lines - lines_before - 1);
+        link_between(doc, after, line, next);
+        doc->num_chunks++;
+        doc->lazy_spans++;
+    }
+
+    free_chunk(span);
+    *local -= start;
+    return line;
+}
+
+// The ops read a line's neighbours for list numbering, merges and
+// block placement, so those are parsed along with it
+static Chunk *materialize_around(document *doc, Chunk *curr, size_t *local)
+{
+    if (curr->type == LAZY_SPAN)
+        curr = materialize_line(doc, curr, local);
+
+    if (curr->previous && curr->previous->type == LAZY_SPAN)
+    {
+        size_t last = curr->previous->len - 1;
+        materialize_line(doc, curr->previous, &last);
+    }
+    if (curr->next && curr->next->type == LAZY_SPAN)
+    {
+        size_t first = 0;
+        materialize_line(doc, curr->next, &first);
+    }
+    return curr;
+}
+
 Chunk *locate_chunk(document *doc, size_t pos, size_t *local_pos)
 {
     Chunk *curr = doc->head;
@@ -87,14 +379,14 @@ Chunk *locate_chunk(document *doc, size_t pos, size_t *local_pos)
     if (!curr && pos == doc->num_characters && doc->tail)
     {
         *local_pos = doc->tail->len;
-        return doc->tail;
+        return doc->lazy_spans ? materialize_around(doc, doc->tail, local_pos) : doc->tail;
     }
 
     if (!curr)
         return NULL;
 
     *local_pos = pos - curr_document_pos;
-    return curr;
+    return doc->lazy_spans ? materialize_around(doc, curr, local_pos) : curr;
 }
 
 Chunk *ensure_line_start(document *doc, size_t *pos_out, size_t *local_pos_out, size_t snapshot_pos)
@@ -127,6 +419,7 @@ void init_chunk(Chunk *chunk, chunk_type type, size_t len, size_t cap, char *tex
     chunk->index_OL = index_OL;
     chunk->next = next;
     chunk->previous = previous;
+    chunk->hashed = false;
     return;
 }
 
@@ -134,7 +427,8 @@ void free_chunk(Chunk *chunk)
 {
     if (chunk)
     {
-        free(chunk->text);
+        if (chunk->type != LAZY_SPAN) // borrowed from doc->lazy_base
+            free(chunk->text);
         free(chunk);
     }
 }
@@ -185,6 +479,7 @@ void chunk_insert(Chunk *curr, size_t local_pos, const char *content, size_t con
     memcpy(curr->text + local_pos, content, content_size);
 
     curr->len += content_size;
+    curr->hashed = false;
 }
 
 int prev_ol_index(Chunk *c)
@@ -197,19 +492,32 @@ int prev_ol_index(Chunk *c)
     return 0;
 }
 
-void renumber_list_from(Chunk *start)
+void renumber_list_from(document *doc, Chunk *start)
 {
+    // Working offset of `start`, only needed to record splices
+    size_t pos = 0;
+    if (doc->splices)
+        for (Chunk *p = start->previous; p; p = p->previous)
+            pos += p->len;
+
     int idx = prev_ol_index(start);
-    for (Chunk *q = start; q && q->type == ORDERED_LIST_ITEM; q = q->next)
+    for (Chunk *q = start; q && q->type == ORDERED_LIST_ITEM; pos += q->len, q = q->next)
     {
         if (idx < 9)
             idx++;
         q->index_OL = idx;
         if (q->len >= 3)
         {
-            q->text[0] = '0' + idx;
-            q->text[1] = '.';
-            q->text[2] = ' ';
+            char prefix[3] = {(char)('0' + idx), '.', ' '};
+            if (memcmp(q->text, prefix, 3) != 0)
+                record_splice(doc, pos, 3, prefix, 3);
+            memcpy(q->text, prefix, 3);
+            q->hashed = false;
+        }
+        if (q->next && q->next->type == LAZY_SPAN)
+        {
+            size_t first = 0;
+            materialize_line(doc, q->next, &first);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,406 @@
+// Microbenchmark for the document engine, linked against markdown.o.
+// For every document size and batch size it queues a batch of one kind
+// of command at spread-out positions, then commits it, timing the queue
+// calls and each phase of markdown_increment_version separately. The
+// grid shows how locate_chunk (chunks walked per command),
+// map_snapshot_to_working (meta log entries per command) and
+// clamp_to_valid (deleted ranges per command) scale.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "markdown.h"
+
+#define MAX_GRID 32
+
+typedef enum bench_op
+{
+    OP_INSERT,
+    OP_DELETE,
+    OP_DELETE_OVERLAP,
+    OP_INLINE,
+    OP_BLOCK,
+    OP_COMMIT, // empty batch: the cost of committing alone
+    OP_COUNT
+} bench_op;
+
+static const char *op_names[OP_COUNT] = {"insert", "delete", "delete_overlap", "inline", "block", "commit"};
+
+typedef struct bench_config
+{
+    size_t sizes[MAX_GRID];
+    size_t num_sizes;
+    size_t batches[MAX_GRID];
+    size_t num_batches;
+    bool ops[OP_COUNT];
+    size_t line_len;
+    int repeat;
+    double budget_s; // larger batches are skipped once a cell takes longer
+    bool json;
+    const char *out;
+} bench_config;
+
+typedef struct bench_result
+{
+    uint64_t queue_ns;
+    uint64_t commit_ns;
+    uint64_t delete_ns;
+    uint64_t insert_ns;
+    uint64_t flatten_ns;
+    size_t chunks; // after the commit
+    size_t rejected;
+} bench_result;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+    // xorshift64*, fixed seed per cell so runs are comparable
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+// === Documents ===
+
+// Builds a committed document of `size` bytes in lines of `line_len`
+// directly from chunks. Going through NEWLINE would cost O(lines^2) in
+// map_snapshot_to_working before a single measurement.
+static document *build_document(size_t size, size_t line_len)
+{
+    document *doc = markdown_init();
+    Chunk *prev = NULL;
+
+    for (size_t done = 0; done < size;)
+    {
+        size_t len = size - done < line_len ? size - done : line_len;
+        size_t cap = calculate_cap(len + 1);
+        char *text = Calloc(cap, sizeof(char));
+        for (size_t i = 0; i + 1 < len; i++)
+            text[i] = (char)('a' + (done + i) % 26);
+        text[len - 1] = '\n';
+
+        Chunk *c = Calloc(1, sizeof(Chunk));
+        init_chunk(c, PLAIN, len, cap, text, 0, NULL, prev);
+        if (prev)
+            prev->next = c;
+        else
+            doc->head = c;
+        prev = c;
+
+        doc->num_chunks++;
+        doc->num_characters += len;
+        done += len;
+    }
+    doc->tail = prev;
+
+    doc->snapshot = flatten_document(doc);
+    doc->snapshot_len = doc->num_characters;
+    return doc;
+}
+
+static int queue_command(document *doc, bench_op op, size_t i, size_t batch, uint64_t *rng)
+{
+    size_t len = doc->snapshot_len;
+    size_t pos = len ? (size_t)(next_rand(rng) % len) : 0;
+
+    switch (op)
+    {
+    case OP_INSERT:
+        return markdown_insert(doc, 0, pos, "bench");
+    case OP_DELETE:
+        return markdown_delete(doc, 0, pos, 4);
+    case OP_DELETE_OVERLAP:
+    {
+        // Evenly spaced ranges twice as long as their spacing, so every
+        // new range merges with its neighbours
+        size_t stride = len / (batch + 1) ? len / (batch + 1) : 1;
+        return markdown_delete(doc, 0, (i * stride) % (len ? len : 1), 2 * stride);
+    }
+    case OP_INLINE:
+    {
+        if (len < 2)
+            return INVALID_CURSOR_POS;
+        pos = pos > len - 2 ? len - 2 : pos;
+        size_t end = pos + 8 < len ? pos + 8 : len;
+        switch (i % 4)
+        {
+        case 0:
+            return markdown_bold(doc, 0, pos, end);
+        case 1:
+            return markdown_italic(doc, 0, pos, end);
+        case 2:
+            return markdown_code(doc, 0, pos, end);
+        default:
+            return markdown_link(doc, 0, pos, end, "https://example.com");
+        }
+    }
+    case OP_BLOCK:
+        switch (i % 6)
+        {
+        case 0:
+            return markdown_newline(doc, 0, pos);
+        case 1:
+            return markdown_heading(doc, 0, 1 + i % 3, pos);
+        case 2:
+            return markdown_blockquote(doc, 0, pos);
+        case 3:
+            return markdown_ordered_list(doc, 0, pos);
+        case 4:
+            return markdown_unordered_list(doc, 0, pos);
+        default:
+            return markdown_horizontal_rule(doc, 0, pos);
+        }
+    default:
+        return SUCCESS;
+    }
+}
+
+static bench_result run_cell(const bench_config *cfg, bench_op op, size_t size, size_t batch)
+{
+    bench_result best = {0};
+
+    for (int r = 0; r < cfg->repeat; r++)
+    {
+        document *doc = build_document(size, cfg->line_len);
+        uint64_t rng = 0x9e3779b97f4a7c15ull ^ (size * 31 + batch);
+        bench_result res = {0};
+
+        uint64_t t0 = now_ns();
+        if (op != OP_COMMIT)
+            for (size_t i = 0; i < batch; i++)
+                if (queue_command(doc, op, i, batch, &rng) != SUCCESS)
+                    res.rejected++;
+        uint64_t t1 = now_ns();
+        markdown_increment_version(doc);
+        uint64_t t2 = now_ns();
+
+        res.queue_ns = t1 - t0;
+        res.commit_ns = t2 - t1;
+        res.delete_ns = doc->commit_delete_ns;
+        res.insert_ns = doc->commit_insert_ns;
+        res.flatten_ns = doc->commit_flatten_ns;
+        res.chunks = doc->num_chunks;
+        markdown_free(doc);
+
+        // Best of the repeats: the least disturbed run
+        if (r == 0 || res.queue_ns + res.commit_ns < best.queue_ns + best.commit_ns)
+            best = res;
+    }
+
+    return best;
+}
+
+// === Output ===
+
+static void emit(FILE *out, const bench_config *cfg, bool *first, bench_op op, size_t size,
+                 size_t batch, const bench_result *r)
+{
+    size_t n = op == OP_COMMIT ? 1 : batch;
+    double per_cmd = (double)(r->queue_ns + r->commit_ns) / (double)n;
+
+    if (cfg->json)
+    {
+        fprintf(out,
+                "%s\n  {\"op\":\"%s\",\"size\":%zu,\"batch\":%zu,\"queue_ns\":%llu,\"commit_ns\":%llu,"
+                "\"delete_ns\":%llu,\"insert_ns\":%llu,\"flatten_ns\":%llu,\"chunks\":%zu,"
+                "\"rejected\":%zu,\"ns_per_cmd\":%.1f}",
+                *first ? "[" : ",", op_names[op], size, n, (unsigned long long)r->queue_ns,
+                (unsigned long long)r->commit_ns, (unsigned long long)r->delete_ns,
+                (unsigned long long)r->insert_ns, (unsigned long long)r->flatten_ns, r->chunks,
+                r->rejected, per_cmd);
+    }
+    else
+    {
+        if (*first)
+            fprintf(out, "op,size,batch,queue_ns,commit_ns,delete_ns,insert_ns,flatten_ns,chunks,rejected,ns_per_cmd\n");
+        fprintf(out, "%s,%zu,%zu,%llu,%llu,%llu,%llu,%llu,%zu,%zu,%.1f\n", op_names[op], size, n,
+                (unsigned long long)r->queue_ns, (unsigned long long)r->commit_ns,
+                (unsigned long long)r->delete_ns, (unsigned long long)r->insert_ns,
+                (unsigned long long)r->flatten_ns, r->chunks, r->rejected, per_cmd);
+    }
+    *first = false;
+    fflush(out);
+}
+
+// === Options ===
+
+static size_t parse_size(const char *s, const char **end)
+{
+    char *e;
+    size_t v = strtoull(s, &e, 10);
+    switch (*e)
+    {
+    case 'K':
+    case 'k':
+        v <<= 10;
+        e++;
+        break;
+    case 'M':
+    case 'm':
+        v <<= 20;
+        e++;
+        break;
+    case 'G':
+    case 'g':
+        v <<= 30;
+        e++;
+        break;
+    default:
+        break;
+    }
+    *end = e;
+    return v;
+}
+
+// Comma-separated sizes with optional K/M/G suffixes
+static int parse_list(const char *s, size_t *out, size_t *count)
+{
+    *count = 0;
+    while (*s)
+    {
+        const char *end;
+        size_t v = parse_size(s, &end);
+        if (end == s || v == 0 || *count == MAX_GRID)
+            return -1;
+        out[(*count)++] = v;
+        s = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return -1;
+    }
+    return *count ? 0 : -1;
+}
+
+static int parse_ops(const char *s, bool *ops)
+{
+    memset(ops, 0, OP_COUNT * sizeof(bool));
+    char *copy = strdup(s);
+    int rc = 0;
+    for (char *save, *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        int found = -1;
+        for (int i = 0; i < OP_COUNT; i++)
+            if (strcmp(tok, op_names[i]) == 0)
+                found = i;
+        if (found < 0)
+            rc = -1;
+        else
+            ops[found] = true;
+    }
+    free(copy);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --sizes=LIST    document sizes, K/M/G suffixes (1K,16K,256K,4M)\n"
+            "  --batches=LIST  commands per commit (1,10,100,1000,10000)\n"
+            "  --ops=LIST      insert,delete,delete_overlap,inline,block,commit (all)\n"
+            "  --line=N        bytes per line of the generated document (64)\n"
+            "  --repeat=N      runs per cell, best one reported (3)\n"
+            "  --budget=S      skip larger batches once a cell takes longer (10)\n"
+            "  --format=F      csv or json (csv)\n"
+            "  --out=PATH      write results here instead of stdout\n"
+            "The full grid is --sizes=1K,1M,1G --batches=1,100,100000; a 1G\n"
+            "document with the default line length needs several GB of memory.\n",
+            prog);
+}
+
+static int parse_args(bench_config *cfg, int argc, char *argv[])
+{
+    *cfg = (bench_config){.line_len = 64, .repeat = 3, .budget_s = 10};
+    parse_list("1K,16K,256K,4M", cfg->sizes, &cfg->num_sizes);
+    parse_list("1,10,100,1000,10000", cfg->batches, &cfg->num_batches);
+    for (int i = 0; i < OP_COUNT; i++)
+        cfg->ops[i] = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        int rc = 0;
+        if (strncmp(a, "--sizes=", 8) == 0)
+            rc = parse_list(a + 8, cfg->sizes, &cfg->num_sizes);
+        else if (strncmp(a, "--batches=", 10) == 0)
+            rc = parse_list(a + 10, cfg->batches, &cfg->num_batches);
+        else if (strncmp(a, "--ops=", 6) == 0)
+            rc = parse_ops(a + 6, cfg->ops);
+        else if (strncmp(a, "--line=", 7) == 0)
+            cfg->line_len = strtoul(a + 7, NULL, 10);
+        else if (strncmp(a, "--repeat=", 9) == 0)
+            cfg->repeat = atoi(a + 9);
+        else if (strncmp(a, "--budget=", 9) == 0)
+            cfg->budget_s = strtod(a + 9, NULL);
+        else if (strcmp(a, "--format=json") == 0)
+            cfg->json = true;
+        else if (strcmp(a, "--format=csv") == 0)
+            cfg->json = false;
+        else if (strncmp(a, "--out=", 6) == 0)
+            cfg->out = a + 6;
+        else
+            rc = -1;
+        if (rc != 0)
+            return -1;
+    }
+
+    return cfg->line_len >= 2 && cfg->repeat >= 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_config cfg;
+    if (parse_args(&cfg, argc, argv) != 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = cfg.out ? fopen(cfg.out, "w") : stdout;
+    if (!out)
+    {
+        perror(cfg.out);
+        return 1;
+    }
+
+    bool first = true;
+    for (size_t s = 0; s < cfg.num_sizes; s++)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            if (!cfg.ops[op])
+                continue;
+
+            for (size_t b = 0; b < cfg.num_batches; b++)
+            {
+                bench_result r = run_cell(&cfg, op, cfg.sizes[s], cfg.batches[b]);
+                emit(out, &cfg, &first, op, cfg.sizes[s], cfg.batches[b], &r);
+
+                double took = (double)(r.queue_ns + r.commit_ns) / 1e9;
+                if (op == OP_COMMIT)
+                    break; // batch size does not apply
+                if (took > cfg.budget_s && b + 1 < cfg.num_batches)
+                {
+                    fprintf(stderr, "%s size=%zu: batch %zu took %.1fs, skipping larger batches\n",
+                            op_names[op], cfg.sizes[s], cfg.batches[b], took);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (cfg.json)
+        fprintf(out, first ? "[]\n" : "\n]\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash_map.h"
+#include "memory.h"
+
+// FNV-1a
+uint64_t hash_string(const char *key)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+    {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+hash_map *hash_map_create(size_t capacity)
+{
+    size_t cap = 16;
+    while (cap < capacity * 2)
+        cap *= 2;
+
+    hash_map *map = Calloc(1, sizeof(hash_map));
+    map->entries = Calloc(cap, sizeof(hash_entry));
+    map->capacity = cap;
+    return map;
+}
+
+void hash_map_free(hash_map *map, void (*free_value)(void *))
+{
+    if (!map)
+        return;
+
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        if (map->entries[i].key)
+        {
+            free(map->entries[i].key);
+            if (free_value)
+                free_value(map->entries[i].value);
+        }
+    }
+    free(map->entries);
+    free(map);
+}
+
+static hash_entry *find_slot(hash_entry *entries, size_t cap, const char *key, uint64_t hash)
+{
+    size_t i = (size_t)hash & (cap - 1);
+    while (entries[i].key &&
+           (entries[i].hash != hash || strcmp(entries[i].key, key) != 0))
+        i = (i + 1) & (cap - 1);
+    return &entries[i];
+}
+
+void *hash_map_get(const hash_map *map, const char *key)
+{
+    hash_entry *e = find_slot(map->entries, map->capacity, key, hash_string(key));
+    return e->key ? e->value : NULL;
+}
+
+static void grow(hash_map *map)
+{
+    size_t cap = map->capacity * 2;
+    hash_entry *entries = Calloc(cap, sizeof(hash_entry));
+
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        hash_entry *old = &map->entries[i];
+        if (old->key)
+            *find_slot(entries, cap, old->key, old->hash) = *old;
+    }
+
+    free(map->entries);
+    map->entries = entries;
+    map->capacity = cap;
+}
+
+void *hash_map_put(hash_map *map, const char *key, void *value)
+{
+    // Keep the load factor at or below 1/2
+    if ((map->size + 1) * 2 > map->capacity)
+        grow(map);
+
+    uint64_t hash = hash_string(key);
+    hash_entry *e = find_slot(map->entries, map->capacity, key, hash);
+
+    if (e->key)
+    {
+        void *prev = e->value;
+        e->value = value;
+        return prev;
+    }
+
+    e->key = strdup(key);
+    e->hash = hash;
+    e->value = value;
+    map->size++;
+    return NULL;
+}
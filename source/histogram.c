@@ -0,0 +1,63 @@
+#include <stddef.h>
+#include "histogram.h"
+
+static size_t bucket_index(uint64_t v)
+{
+    if (v < HIST_SUB_COUNT)
+        return (size_t)v;
+    unsigned e = 63 - (unsigned)__builtin_clzll(v); // >= HIST_SUB_BITS
+    size_t band = e - HIST_SUB_BITS + 1;
+    size_t sub = (size_t)(v >> (e - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return band * HIST_SUB_COUNT + sub;
+}
+
+static uint64_t bucket_upper(size_t idx)
+{
+    size_t band = idx / HIST_SUB_COUNT;
+    size_t sub = idx % HIST_SUB_COUNT;
+    if (band == 0)
+        return sub;
+    uint64_t lower = (uint64_t)(HIST_SUB_COUNT + sub) << (band - 1);
+    return lower + ((uint64_t)1 << (band - 1)) - 1;
+}
+
+void histogram_record(histogram *h, uint64_t value)
+{
+    h->counts[bucket_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+uint64_t histogram_quantile(const histogram *h, double q)
+{
+    if (h->total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)h->total);
+    if (rank >= h->total)
+        rank = h->total - 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen > rank)
+        {
+            uint64_t v = bucket_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void histogram_merge(histogram *dst, const histogram *src)
+{
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
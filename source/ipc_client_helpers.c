@@ -6,31 +6,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "ipc_helpers.h"
+#include "markdown.h"
 #include "memory.h"
 
-void infer_chunk_type(const char *line, size_t len, chunk_type *type_out, int *index_OL_out)
-{
-    *type_out = PLAIN;
-    *index_OL_out = 0;
-
-    if (len == 4 && strncmp(line, "---\n", 4) == 0)
-        *type_out = HORIZONTAL_RULE;
-    else if (len >= 2 && line[0] == '>' && line[1] == ' ')
-        *type_out = BLOCKQUOTE;
-    else if (len >= 2 && line[0] == '-' && line[1] == ' ')
-        *type_out = UNORDERED_LIST_ITEM;
-    else if (len >= 2 && line[0] == '#' && line[1] == ' ')
-        *type_out = HEADING1;
-    else if (len >= 3 && line[0] == '#' && line[1] == '#' && line[2] == ' ')
-        *type_out = HEADING2;
-    else if (len >= 4 && line[0] == '#' && line[1] == '#' && line[2] == '#' && line[3] == ' ')
-        *type_out = HEADING3;
-    else if (len >= 3 && line[1] == '.' && line[2] == ' ' && line[0] >= '1' && line[0] <= '9') {
-        *type_out = ORDERED_LIST_ITEM;
-        *index_OL_out = line[0] - '0';
-    }
-}
-
 void markdown_parse_string(document *doc, const char *text)
 {
     if (!doc || !text) return;
@@ -42,12 +20,10 @@ void markdown_parse_string(document *doc, const char *text)
         if (*cursor == '\n')
         {
             size_t len = cursor - start;
-            char *line = Calloc(len + 2, sizeof(char));
+            size_t cap = calculate_cap(len + 2);
+            char *line = Calloc(cap, sizeof(char));
             memcpy(line, start, len);
             line[len] = '\n';
-            line[len + 1] = '\0';
-
-            size_t cap = calculate_cap(len + 1);
             chunk_type type;
             int index_OL;
             infer_chunk_type(line, len + 1, &type, &index_OL);
@@ -71,20 +47,19 @@ void markdown_parse_string(document *doc, const char *text)
         else cursor++;
     }
 
+    // A final line without a newline is kept as-is so the chunks add up
+    // to exactly the snapshot they were parsed from
     if (cursor > start) {
         size_t len = cursor - start;
-        char *line = Calloc(len + 2, sizeof(char));
-        memcpy(line, start, len);
-        line[len] = '\n';
-        line[len + 1] = '\0';
-
         size_t cap = calculate_cap(len + 1);
+        char *line = Calloc(cap, sizeof(char));
+        memcpy(line, start, len);
         chunk_type type;
         int index_OL;
-        infer_chunk_type(line, len + 1, &type, &index_OL);
+        infer_chunk_type(line, len, &type, &index_OL);
 
         Chunk *chunk = Calloc(1, sizeof(Chunk));
-        init_chunk(chunk, type, len + 1, cap, line, index_OL, NULL, NULL);
+        init_chunk(chunk, type, len, cap, line, index_OL, NULL, NULL);
 
         if (!doc->head)
             doc->head = doc->tail = chunk;
@@ -99,31 +74,181 @@ void markdown_parse_string(document *doc, const char *text)
     }
 }
 
-void apply_broadcast(const char *msg)
+// Applies the successful EDIT lines of one broadcast in place; `msg`
+// need not be '\0'-terminated. The result is the line's last word, so
+// inserted text that happens to contain " SUCCESS" is not cut short.
+void apply_broadcast(const char *msg, size_t len)
 {
     if (!msg || !local_doc)
         return;
 
-    char *copy = strdup(msg);
-    char *line = strtok(copy, "\n");
-
-    while (line) {
-        if (strncmp(line, "EDIT ", 5) == 0) {
-            char *edit_ptr = line + 5;
-            char *success_ptr = strstr(edit_ptr, " SUCCESS");
-            if (success_ptr) {
-                *success_ptr = '\0';
-                char *cmd_start = strchr(edit_ptr, ' ');
-                if (cmd_start && *(cmd_start + 1)) {
-                    cmd_start++;
-                    char *raw = strdup(cmd_start);
-                    process_raw_command(local_doc, &(cmd_ipc){ .raw_command = raw, .role = "write" });
-                    free(raw);
+    static const char suffix[] = " SUCCESS";
+    size_t suffix_len = sizeof(suffix) - 1;
+    const char *end = msg + len;
+
+    for (const char *line = msg; line < end;) {
+        const char *nl = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = nl ? nl : end;
+        size_t line_len = (size_t)(line_end - line);
+
+        if (line_len > 5 + suffix_len && strncmp(line, "EDIT ", 5) == 0 &&
+            memcmp(line_end - suffix_len, suffix, suffix_len) == 0) {
+            const char *cmd_start = memchr(line + 5, ' ', line_len - 5 - suffix_len);
+            if (cmd_start && cmd_start + 1 < line_end - suffix_len) {
+                cmd_start++;
+                char *raw = strndup(cmd_start, (size_t)(line_end - suffix_len - cmd_start));
+                process_raw_command(local_doc, &(cmd_ipc){ .raw_command = raw, .role = "write" });
+                free(raw);
+            }
+        }
+        line = line_end + 1;
+    }
+}
+
+// === Server-resolved splices ===
+
+static void link_chunk(document *doc, Chunk *chunk, Chunk *prev, Chunk *next)
+{
+    chunk->previous = prev;
+    chunk->next = next;
+    if (prev)
+        prev->next = chunk;
+    else
+        doc->head = chunk;
+    if (next)
+        next->previous = chunk;
+    else
+        doc->tail = chunk;
+}
+
+// Replaces `del` bytes at working position `pos` with `text`. Only the
+// lines the splice touches are rebuilt: their old text around the
+// splice is joined and split into lines again, with types inferred as
+// markdown_parse_string() does for a snapshot.
+static int splice_chunks(document *doc, size_t pos, size_t del, const char *text, size_t len)
+{
+    if (pos > doc->num_characters || del > doc->num_characters - pos)
+        return INVALID_CURSOR_POS;
+
+    size_t local = 0;
+    if (doc->lazy_spans)
+        locate_chunk(doc, pos + del, &local); // parses the line the splice ends in
+    Chunk *first = locate_chunk(doc, pos, &local);
+    Chunk *last = first;
+    size_t end = local + del; // offset of the splice's end within `last`
+    while (last && end > last->len && last->next)
+    {
+        end -= last->len;
+        last = last->next;
+    }
+
+    // A line whose newline was deleted runs on into the next one
+    if (last && end == last->len && last->next &&
+        (local + len == 0 || (len ? text[len - 1] : first->text[local - 1]) != '\n'))
+    {
+        last = last->next;
+        end = 0;
+    }
+
+    size_t head_len = local;
+    size_t tail_len = last ? last->len - end : 0;
+    size_t joined_len = head_len + len + tail_len;
+    char *joined = Calloc(joined_len + 1, sizeof(char));
+    if (first)
+        memcpy(joined, first->text, head_len);
+    memcpy(joined + head_len, text, len);
+    if (last)
+        memcpy(joined + head_len + len, last->text + end, tail_len);
+
+    // Unlink first..last
+    Chunk *prev = first ? first->previous : doc->tail;
+    Chunk *next = last ? last->next : NULL;
+    for (Chunk *c = first; c;)
+    {
+        Chunk *following = c == last ? NULL : c->next;
+        doc->num_characters -= c->len;
+        doc->num_chunks--;
+        free_chunk(c);
+        c = following;
+    }
+    if (prev)
+        prev->next = next;
+    else
+        doc->head = next;
+    if (next)
+        next->previous = prev;
+    else
+        doc->tail = prev;
+
+    for (size_t start = 0; start < joined_len;)
+    {
+        const char *nl = memchr(joined + start, '\n', joined_len - start);
+        size_t line_len = nl ? (size_t)(nl - joined) - start + 1 : joined_len - start;
+        size_t cap = calculate_cap(line_len + 1);
+        char *line = Calloc(cap, sizeof(char));
+        memcpy(line, joined + start, line_len);
+
+        chunk_type type;
+        int index_OL;
+        infer_chunk_type(line, line_len, &type, &index_OL);
+        Chunk *chunk = Calloc(1, sizeof(Chunk));
+        init_chunk(chunk, type, line_len, cap, line, index_OL, NULL, NULL);
+        link_chunk(doc, chunk, prev, next);
+
+        doc->num_chunks++;
+        doc->num_characters += line_len;
+        prev = chunk;
+        start += line_len;
+    }
+
+    free(joined);
+    return SUCCESS;
+}
+
+// Applies the "SPLICE <pos> <del> <text>" lines of a broadcast built for
+// a deltas=1 client. Returns false if the broadcast carries none (it
+// predates our connection or came from the log), so the caller falls
+// back to re-running its EDIT lines.
+bool apply_splices(const char *msg, size_t len)
+{
+    const char *end = msg + len;
+    bool found = false;
+    char *text = NULL;
+    size_t text_cap = 0;
+
+    for (const char *line = msg; line < end;) {
+        const char *nl = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = nl ? nl : end;
+
+        if ((size_t)(line_end - line) >= 8 && strncmp(line, "SPLICES ", 8) == 0)
+            found = true;
+        else if ((size_t)(line_end - line) > 7 && strncmp(line, "SPLICE ", 7) == 0) {
+            char *p;
+            size_t pos = strtoull(line + 7, &p, 10);
+            size_t del = strtoull(p, &p, 10);
+
+            // Unescape the rest of the line
+            const char *src = p < line_end && *p == ' ' ? p + 1 : line_end;
+            if ((size_t)(line_end - src) + 1 > text_cap) {
+                text_cap = (size_t)(line_end - src) + 1;
+                text = realloc(text, text_cap);
+            }
+            size_t n = 0;
+            for (; src < line_end; src++) {
+                if (*src == '\\' && src + 1 < line_end) {
+                    src++;
+                    text[n++] = *src == 'n' ? '\n' : *src;
                 }
+                else
+                    text[n++] = *src;
             }
+
+            if (splice_chunks(local_doc, pos, del, text ? text : "", n) != SUCCESS)
+                fprintf(stderr, "Bad splice at %zu\n", pos);
         }
-        line = strtok(NULL, "\n");
+        line = line_end + 1;
     }
 
-    free(copy);
+    free(text);
+    return found;
 }
@@ -1,8 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include "ipc_helpers.h"
 #include "memory.h"
 #include "document.h"
@@ -38,6 +40,118 @@ char *read_line_dynamic(int fd)
     return buf;
 }
 
+// The same hash the engine folds from its chunks (document_hash()), so
+// a flat copy and a chunked document can be compared
+uint64_t snapshot_checksum(const char *data, size_t len)
+{
+    return text_hash(data, len, NULL);
+}
+
+// Offset of line `n`, clamped to the end: binary search for the last
+// mark at or before it, then a scan over the lines in between
+static size_t line_offset(const char *data, size_t len, const line_mark *marks, size_t nmarks,
+                          size_t n)
+{
+    size_t lo = 0, hi = nmarks - 1;
+    if (n >= marks[hi].line)
+        return len;
+    while (lo + 1 < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (marks[mid].line <= n)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    size_t off = marks[lo].offset;
+    for (size_t line = marks[lo].line; line < n; line++)
+    {
+        const char *nl = memchr(data + off, '\n', len - off);
+        if (!nl)
+            return len;
+        off = (size_t)(nl - data) + 1;
+    }
+    return off;
+}
+
+int resolve_doc_range(const char *args, const char *data, size_t len,
+                      const line_mark *marks, size_t nmarks, size_t *from, size_t *to)
+{
+    char unit[8];
+    unsigned long long a, b;
+    char extra;
+    if (sscanf(args, " %7s %llu %llu %c", unit, &a, &b, &extra) != 3 || a > b)
+        return -1;
+
+    if (strcmp(unit, "lines") == 0)
+    {
+        *from = line_offset(data, len, marks, nmarks, (size_t)a);
+        *to = line_offset(data, len, marks, nmarks, (size_t)b);
+    }
+    else if (strcmp(unit, "bytes") == 0)
+    {
+        *from = a < len ? (size_t)a : len;
+        *to = b < len ? (size_t)b : len;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int write_all(int fd, const void *data, size_t len)
+{
+    const char *buf = data;
+    while (len > 0)
+    {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+int send_file_range(int out_fd, int in_fd, off_t off, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = sendfile(out_fd, in_fd, &off, len);
+        if (n > 0)
+        {
+            len -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EINVAL && errno != ENOSYS)
+            return -1;
+        break;
+    }
+
+    // Fallback for outputs sendfile() cannot target
+    char buf[65536];
+    while (len > 0)
+    {
+        ssize_t r = pread(in_fd, buf, len < sizeof(buf) ? len : sizeof(buf), off);
+        if (r <= 0)
+            return -1;
+        if (write_all(out_fd, buf, (size_t)r) != 0)
+            return -1;
+        off += r;
+        len -= (size_t)r;
+    }
+
+    return 0;
+}
+
 int process_raw_command(document *doc, cmd_ipc *cmd)
 {
     if (!doc || !cmd || !cmd->raw_command)
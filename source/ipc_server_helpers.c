@@ -5,82 +5,170 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdatomic.h>
 #include "ipc_helpers.h"
+#include "client_registry.h"
+#include "cmd_queue.h"
+#include "doc_registry.h"
+#include "log_index.h"
+#include "roles.h"
+#include "segment_log.h"
+#include "snapshot_share.h"
+#include "stats.h"
+#include "throttle.h"
+#include "tick_scheduler.h"
+#include "trace.h"
 #include "memory.h"
 #include "markdown.h"
 
 #define INITIAL_CAPACITY 512
+#define LOG_HEADER_RESERVE 64
 
-#include <time.h>
+// Consumes a leading "doc=<name>" from a query's arguments. Only
+// existing documents are looked up; queries never create one.
+static hosted_doc *query_doc(const char **args)
+{
+    const char *a = *args;
+    while (*a == ' ')
+        a++;
+    if (strncmp(a, "doc=", 4) != 0)
+        return doc_registry_default();
+
+    a += 4;
+    size_t n = strcspn(a, " ");
+    char name[DOC_NAME_MAX + 1];
+    if (n > DOC_NAME_MAX)
+        return NULL;
+    memcpy(name, a, n);
+    name[n] = '\0';
 
-void sleep_ms(unsigned long milliseconds)
+    *args = a + n;
+    return doc_registry_find(name);
+}
+
+static void save_document(hosted_doc *d)
 {
-    struct timespec ts;
-    ts.tv_sec = milliseconds / 1000;
-    ts.tv_nsec = (milliseconds % 1000) * 1000000UL;
-    nanosleep(&ts, NULL);
+    FILE *f = fopen(d->path, "w");
+    if (f == NULL)
+        return;
+
+    doc_view *v = doc_view_acquire(d);
+    fwrite(v->data, 1, v->len, f);
+    doc_view_release(v);
+    fclose(f);
 }
 
-void handle_server_stdin(void)
+int handle_server_stdin(void)
 {
-    fd_set set;
-    struct timeval timeout = {0, 0};
-    FD_ZERO(&set);
-    FD_SET(STDIN_FILENO, &set);
+    // Unbuffered so that poll() on stdin never misses a queued line
+    char *line = read_line_dynamic(STDIN_FILENO);
+    if (!line)
+        return -1;
 
-    if (select(STDIN_FILENO + 1, &set, NULL, NULL, &timeout) <= 0)
+    if (strcmp(line, "DOC?") == 0 || strncmp(line, "DOC? ", 5) == 0)
     {
-        return; 
+        const char *args = line + 4;
+        hosted_doc *d = query_doc(&args);
+        if (!d)
+        {
+            printf("No such document.\n");
+            fflush(stdout);
+        }
+        else
+        {
+            // Optionally only "lines <a> <b>" or "bytes <a> <b>" of it
+            doc_view *v = doc_view_acquire(d);
+            size_t from = 0, to = v->len;
+            while (*args == ' ')
+                args++;
+            if (*args && resolve_doc_range(args, v->data, v->len, v->line_marks, v->marks, &from, &to) < 0)
+                printf("Usage: DOC? [doc=<name>] [lines|bytes <from> <to>]\n");
+            else
+                fwrite(v->data + from, 1, to - from, stdout);
+            fflush(stdout);
+            doc_view_release(v);
+        }
     }
-
-    char *line = NULL;
-    size_t len = 0;
-
-    if (getline(&line, &len, stdin) == -1)
+    else if (strcmp(line, "DOCS?") == 0)
     {
-        free(line);
-        return;
+        array_list *docs = create_array(16);
+        doc_registry_list(docs);
+        for (size_t i = 0; i < docs->size; i++)
+        {
+            hosted_doc *d = get_from(docs, i);
+            size_t num_clients = client_registry_count(d->clients);
+            doc_view *v = doc_view_acquire(d);
+            uint64_t version = v->version;
+            doc_view_release(v);
+            printf("%s version=%llu clients=%zu\n", d->name, (unsigned long long)version, num_clients);
+        }
+        fflush(stdout);
+        docs->size = 0;
+        free_array(docs);
     }
-
-    if (strcmp(line, "DOC?\n") == 0)
+    else if (strcmp(line, "LOG?") == 0 || strncmp(line, "LOG? ", 5) == 0)
     {
-        pthread_mutex_lock(&doc_mutex);
-        char *flattened = markdown_flatten(global_doc);
-        fputs(flattened, stdout);
+        const char *args = line + 4;
+        hosted_doc *d = query_doc(&args);
+        if (!d)
+        {
+            printf("No such document.\n");
+            fflush(stdout);
+        }
+        else
+        {
+            flush_idle_run(d);
+            handle_log_query(d, args);
+        }
+    }
+    else if (strcmp(line, "STATS?") == 0)
+    {
+        stats_write_json(stdout);
         fflush(stdout);
-        free(flattened);
-        pthread_mutex_unlock(&doc_mutex);
     }
-    else if (strcmp(line, "LOG?\n") == 0)
+    else if (strcmp(line, "TRACE?") == 0 || strncmp(line, "TRACE? ", 7) == 0)
     {
-        pthread_mutex_lock(&log_mutex);
-        fwrite(server_log, 1, server_log_len, stdout);
+        const char *path = line[6] ? trim(line + 7) : "trace.json";
+        long n = trace_dump(path);
+        if (n < 0)
+            printf("TRACE? failed: %s\n", path);
+        else
+            printf("TRACE? wrote %ld events to %s\n", n, path);
         fflush(stdout);
-        pthread_mutex_unlock(&log_mutex);
     }
-    else if (strcmp(line, "QUIT?\n") == 0)
+    else if (strcmp(line, "THROTTLE?") == 0 || strncmp(line, "THROTTLE? ", 10) == 0)
     {
-        pthread_mutex_lock(&client_list_mutex);
-        size_t num_clients = connected_clients->size;
-        pthread_mutex_unlock(&client_list_mutex);
+        const char *args = line + 9;
+        hosted_doc *d = query_doc(&args);
+        if (!d)
+            printf("No such document.\n");
+        else
+            throttle_report(d->throttle, d->name, d->cmd_carry->size, stdout);
+        fflush(stdout);
+    }
+    else if (strcmp(line, "QUIT?") == 0)
+    {
+        array_list *docs = create_array(16);
+        doc_registry_list(docs);
+
+        size_t num_clients = 0;
+        for (size_t i = 0; i < docs->size; i++)
+        {
+            hosted_doc *d = get_from(docs, i);
+            flush_idle_run(d);
+            num_clients += client_registry_count(d->clients);
+        }
 
         if (num_clients == 0)
         {
-            FILE *f = fopen("doc.md", "w");
-            if (f != NULL)
-            {
-                pthread_mutex_lock(&doc_mutex);
-                char *flattened = markdown_flatten(global_doc);
-                fwrite(flattened, 1, strlen(flattened), f);
-                free(flattened);
-                pthread_mutex_unlock(&doc_mutex);
-                fclose(f);
-            }
+            for (size_t i = 0; i < docs->size; i++)
+                save_document(get_from(docs, i));
+            docs->size = 0;
+            free_array(docs);
             free_server_resources();
             exit(0);
         }
@@ -89,9 +177,12 @@ void handle_server_stdin(void)
             printf("QUIT rejected, %zu clients still connected.\n", num_clients);
             fflush(stdout);
         }
+        docs->size = 0;
+        free_array(docs);
     }
 
     free(line);
+    return 0;
 }
 
 void free_cmd_ipc(void *ptr)
@@ -106,80 +197,310 @@ void free_cmd_ipc(void *ptr)
 
 void free_server_resources(void)
 {
-    if (global_doc)
+    doc_registry_free();
+    roles_free();
+}
+
+void reset_log_buffer(hosted_doc *d)
+{
+    if (!d->log_entry)
+    {
+        d->log_cap = INITIAL_CAPACITY;
+        d->log_entry = Calloc(d->log_cap, sizeof(char));
+    }
+    // The VERSION line is only known after the batch is applied, so
+    // room for it is kept in front of the EDIT lines
+    d->log_start = LOG_HEADER_RESERVE;
+    d->log_len = LOG_HEADER_RESERVE;
+    d->log_entry[d->log_len] = '\0';
+    d->log_offset = UINT64_MAX;
+    d->delta_len = 0;
+}
+
+void set_log_version(hosted_doc *d, uint64_t version)
+{
+    char line[LOG_HEADER_RESERVE];
+    int n = snprintf(line, sizeof(line), "VERSION %llu %016llx\n", (unsigned long long)version,
+                     (unsigned long long)d->checksum);
+    d->log_start = LOG_HEADER_RESERVE - n;
+    memcpy(d->log_entry + d->log_start, line, n);
+    d->log_version = version;
+}
+
+void append_to_log_buffer(hosted_doc *d, const char *data, size_t len)
+{
+    if (d->log_len + len + 1 > d->log_cap)
     {
-        markdown_free(global_doc);
-        global_doc = NULL;
+        d->log_cap = (d->log_len + len + 1) * 2;
+        d->log_entry = realloc(d->log_entry, d->log_cap);
     }
+    memcpy(d->log_entry + d->log_len, data, len);
+    d->log_len += len;
+    d->log_entry[d->log_len] = '\0';
+}
 
-    if (global_cmd_list)
+static void delta_append(hosted_doc *d, const char *data, size_t len)
+{
+    if (d->delta_len + len > d->delta_cap)
     {
-        for (size_t i = 0; i < global_cmd_list->size; i++)
-            free_cmd_ipc(get_from(global_cmd_list, i));
-        free_array(global_cmd_list);
-        global_cmd_list = NULL;
+        d->delta_cap = (d->delta_len + len) * 2;
+        d->delta_entry = realloc(d->delta_entry, d->delta_cap);
     }
+    memcpy(d->delta_entry + d->delta_len, data, len);
+    d->delta_len += len;
+}
+
+// Copies the finished entry and inserts "SPLICES n" and one
+// "SPLICE <pos> <del> <text>" line per splice the commit recorded
+// before its END. Newlines and backslashes in the text are escaped so
+// the broadcast stays line-framed.
+void build_delta_entry(hosted_doc *d)
+{
+    array_list *splices = d->doc->splices;
+    const char *entry = d->log_entry + d->log_start;
+    size_t len = d->log_len - d->log_start - 4; // without "END\n"
 
-    if (connected_clients)
+    d->delta_len = 0;
+    delta_append(d, entry, len);
+
+    char line[64];
+    int n = snprintf(line, sizeof(line), "SPLICES %zu\n", splices->size);
+    delta_append(d, line, n);
+
+    for (size_t i = 0; i < splices->size; i++)
     {
-        for (size_t i = 0; i < connected_clients->size; i++)
+        text_splice *s = get_from(splices, i);
+        n = snprintf(line, sizeof(line), "SPLICE %zu %zu%s", s->pos, s->del, s->len ? " " : "");
+        delta_append(d, line, n);
+
+        size_t from = 0;
+        for (size_t j = 0; j < s->len; j++)
         {
-            client_info *c = get_from(connected_clients, i);
-            free(c->username);
-            free(c->permission);
+            if (s->text[j] != '\n' && s->text[j] != '\\')
+                continue;
+            delta_append(d, s->text + from, j - from);
+            delta_append(d, s->text[j] == '\n' ? "\\n" : "\\\\", 2);
+            from = j + 1;
         }
-        free_array(connected_clients);
-        connected_clients = NULL;
+        delta_append(d, s->text + from, s->len - from);
+        delta_append(d, "\n", 1);
     }
+    delta_append(d, "END\n", 4);
+}
+
+static uint64_t server_log_append(hosted_doc *d, const char *data, size_t len, uint64_t version)
+{
+    pthread_rwlock_wrlock(&d->log_lock);
+    uint64_t offset = d->log->total_len;
+    uint64_t base = d->log->base_offset;
 
-    free(server_log);
-    server_log = NULL;
-    free(current_log_entry);
-    current_log_entry = NULL;
+    // LOG? and delta resync go stale from here on, so make it visible
+    if (segment_log_append(d->log, data, len) != 0)
+    {
+        perror("server log append");
+        d->stats->log_errors++;
+    }
+    else
+        log_index_add(d->log_index, version, d->checksum, offset, data, len);
+
+    if (d->log->base_offset != base)
+        log_index_prune(d->log_index, d->log->base_offset);
+    pthread_rwlock_unlock(&d->log_lock);
+    return offset;
 }
 
-void reset_log_buffer(void)
+void append_to_server_log(hosted_doc *d)
 {
-    if (!current_log_entry)
+    d->log_offset = server_log_append(d, d->log_entry + d->log_start,
+                                      d->log_len - d->log_start, d->log_version);
+}
+
+// === LOG? queries ===
+
+// Byte ranges picked out of the log under the read lock and streamed
+// once it is dropped, so appends never wait on stdout
+typedef struct log_read
+{
+    uint64_t *bounds; // [from, to) pairs
+    size_t count;
+    size_t cap;
+} log_read;
+
+static void add_range(log_read *r, uint64_t from, uint64_t to)
+{
+    // Adjacent records go out in a single sendfile sweep
+    if (r->count && r->bounds[2 * r->count - 1] == from)
     {
-        current_log_cap = INITIAL_CAPACITY;
-        current_log_entry = Calloc(current_log_cap, sizeof(char));
+        r->bounds[2 * r->count - 1] = to;
+        return;
     }
-    current_log_len = 0;
-    current_log_entry[0] = '\0';
+    if (r->count == r->cap)
+    {
+        r->cap = r->cap ? r->cap * 2 : 8;
+        r->bounds = realloc(r->bounds, r->cap * 2 * sizeof(uint64_t));
+    }
+    r->bounds[2 * r->count] = from;
+    r->bounds[2 * r->count + 1] = to;
+    r->count++;
 }
 
-void append_to_log_buffer(const char *data, size_t len)
+static void add_records(hosted_doc *d, log_read *r, size_t first, size_t last)
 {
-    if (current_log_len + len + 1 > current_log_cap)
+    const log_record *a = log_index_get(d->log_index, first);
+    const log_record *b = log_index_get(d->log_index, last - 1);
+    if (a && b)
+        add_range(r, a->offset, b->offset + b->len);
+}
+
+static void add_user_records(hosted_doc *d, log_read *r, const char *username)
+{
+    const posting_list *p = log_index_user(d->log_index, username);
+    if (!p)
+        return;
+    for (size_t i = 0; i < p->count; i++)
+        add_records(d, r, p->ids[i], p->ids[i] + 1);
+}
+
+// `args` is whatever follows "LOG? [doc=<name>]": empty, " <from> <to>"
+// or " user=<name>"
+void handle_log_query(hosted_doc *d, const char *args)
+{
+    while (*args == ' ')
+        args++;
+
+    log_read r = {0};
+    log_span span = {0};
+    const char *error = NULL;
+
+    pthread_rwlock_rdlock(&d->log_lock);
+
+    if (*args == '\0')
     {
-        current_log_cap = (current_log_len + len + 1) * 2;
-        current_log_entry = realloc(current_log_entry, current_log_cap);
+        add_range(&r, 0, UINT64_MAX);
     }
-    memcpy(current_log_entry + current_log_len, data, len);
-    current_log_len += len;
-    current_log_entry[current_log_len] = '\0';
+    else if (strncmp(args, "user=", 5) == 0)
+    {
+        if (d->log_index->track_users)
+            add_user_records(d, &r, args + 5);
+        else
+            error = "LOG? user= requires --log-user-index\n";
+    }
+    else
+    {
+        char *end = NULL;
+        unsigned long long from = strtoull(args, &end, 10);
+        char *end2 = NULL;
+        unsigned long long to = (end != args) ? strtoull(end, &end2, 10) : 0;
+
+        if (end == args || end2 == end || *trim(end2) != '\0' || from > to)
+        {
+            error = "Usage: LOG? [doc=<name>] [<from> <to> | user=<name>]\n";
+        }
+        else
+        {
+            size_t first = log_index_lower_bound(d->log_index, from);
+            size_t last = to == UINT64_MAX ? SIZE_MAX : log_index_lower_bound(d->log_index, to + 1);
+            size_t end_id = d->log_index->first_id + d->log_index->count;
+            if (last > end_id)
+                last = end_id;
+            if (first < last)
+                add_records(d, &r, first, last);
+        }
+    }
+
+    if (r.count)
+        segment_log_pin(d->log, r.bounds[0], r.bounds[2 * r.count - 1], &span);
+
+    pthread_rwlock_unlock(&d->log_lock);
+
+    fflush(stdout);
+    if (error)
+        dprintf(STDOUT_FILENO, "%s", error);
+    for (size_t i = 0; i < r.count; i++)
+        log_span_stream(&span, STDOUT_FILENO, r.bounds[2 * i], r.bounds[2 * i + 1]);
+
+    log_span_release(&span);
+    free(r.bounds);
 }
 
-void append_to_server_log(void)
+// === Idle tick coalescing ===
+
+void note_idle_tick(hosted_doc *d)
+{
+    if (d->idle_run_ticks == 0)
+        d->idle_run_version = d->version;
+    d->idle_run_ticks++;
+}
+
+void flush_idle_run(hosted_doc *d)
 {
-    pthread_mutex_lock(&log_mutex);
-    server_log = realloc(server_log, server_log_len + current_log_len + 1);
-    memcpy(server_log + server_log_len, current_log_entry, current_log_len);
-    server_log_len += current_log_len;
-    server_log[server_log_len] = '\0';
-    pthread_mutex_unlock(&log_mutex);
+    if (d->idle_run_ticks == 0)
+        return;
+
+    // One range record stands in for the whole run of empty ticks
+    char record[96];
+    int n = snprintf(record, sizeof(record), "VERSION %llu\nIDLE %llu\nEND\n",
+                     (unsigned long long)d->idle_run_version,
+                     (unsigned long long)d->idle_run_ticks);
+    server_log_append(d, record, n, d->idle_run_version);
+    d->idle_run_ticks = 0;
+}
+
+bool heartbeat_due(hosted_doc *d, unsigned long heartbeat_ms, unsigned long interval_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t elapsed_ms = (uint64_t)(now.tv_sec - d->last_broadcast.tv_sec) * 1000 +
+                          (now.tv_nsec - d->last_broadcast.tv_nsec) / 1000000;
+
+    // Half a period of slack so timer jitter never skips a whole keepalive
+    unsigned long slack = (interval_ms < heartbeat_ms ? interval_ms : heartbeat_ms) / 2;
+    return elapsed_ms + slack >= heartbeat_ms;
 }
 
-void send_broadcast_to_all_clients(void)
+static void backlog_append(client_info *c, const char *data, size_t len)
 {
-    pthread_mutex_lock(&client_list_mutex);
-    for (size_t i = 0; i < connected_clients->size; i++)
+    if (c->backlog_len + len > c->backlog_cap)
     {
-        client_info *c = get_from(connected_clients, i);
-        write(c->fd_s2c, current_log_entry, current_log_len);
+        c->backlog_cap = (c->backlog_len + len) * 2;
+        c->backlog = realloc(c->backlog, c->backlog_cap);
     }
-    pthread_mutex_unlock(&client_list_mutex);
+    memcpy(c->backlog + c->backlog_len, data, len);
+    c->backlog_len += len;
+}
+
+void send_broadcast_to_all_clients(hosted_doc *d)
+{
+    clock_gettime(CLOCK_MONOTONIC, &d->last_broadcast);
+
+    const char *entry = d->log_entry + d->log_start;
+    size_t len = d->log_len - d->log_start;
+    size_t delta_clients = 0;
+
+    TRACE_BEGIN("send_broadcast_to_all_clients");
+    client_iter it;
+    client_registry_iter_begin(d->clients, &it);
+    for (size_t i = 0; i < it.count; i++)
+    {
+        client_info *c = it.clients[i];
+        bool delta = c->deltas && d->delta_len;
+        const char *msg = delta ? d->delta_entry : entry;
+        size_t msg_len = delta ? d->delta_len : len;
+        delta_clients += delta;
+
+        pthread_mutex_lock(&c->lock);
+        if (!c->pending)
+            write(c->fd_s2c, msg, msg_len);
+        else if (d->log_offset == UINT64_MAX || d->log_offset >= c->resume_offset)
+            backlog_append(c, msg, msg_len);
+        pthread_mutex_unlock(&c->lock);
+    }
+    d->stats->broadcasts++;
+    d->stats->bytes_broadcast += (uint64_t)len * (it.count - delta_clients) +
+                                 (uint64_t)d->delta_len * delta_clients;
+    client_registry_iter_end(d->clients, &it);
+    TRACE_END("send_broadcast_to_all_clients");
 }
 
 char *trim(char *str)
@@ -195,8 +516,10 @@ char *trim(char *str)
     return str;
 }
 
-void get_user_role(char **username_out, char **role_out, int fd)
+void get_user_role(char **username_out, char **role_out, handshake_opts *opts, int fd)
 {
+    *opts = (handshake_opts){0};
+
     char *raw = read_line_dynamic(fd);
     if (!raw)
     {
@@ -205,57 +528,216 @@ void get_user_role(char **username_out, char **role_out, int fd)
         return;
     }
 
-    *username_out = strdup(trim(raw));
+    // "<username> [key=value ...]"; unknown options are ignored
+    char *saveptr = NULL;
+    char *user = strtok_r(raw, " \t\r", &saveptr);
+    for (char *opt = strtok_r(NULL, " \t\r", &saveptr); opt; opt = strtok_r(NULL, " \t\r", &saveptr))
+    {
+        if (strcmp(opt, "map=1") == 0)
+            opts->map_snapshot = true;
+        else if (strncmp(opt, "since=", 6) == 0)
+            opts->since = strtoull(opt + 6, NULL, 10);
+        else if (strncmp(opt, "sum=", 4) == 0)
+        {
+            opts->checksum = strtoull(opt + 4, NULL, 16);
+            opts->resume = true;
+        }
+        else if (strncmp(opt, "doc=", 4) == 0 && !opts->doc)
+            opts->doc = strdup(opt + 4);
+        else if (strcmp(opt, "deltas=1") == 0)
+            opts->deltas = true;
+    }
+
+    *username_out = strdup(user ? user : "");
     free(raw);
 
-    FILE *f = fopen("roles.txt", "r");
-    if (!f)
+    *role_out = roles_lookup(*username_out);
+}
+
+// === Handshake bootstrap ===
+
+typedef struct delta_range
+{
+    uint64_t from; // global log offsets [from, to)
+    uint64_t to;
+    uint64_t version; // version the client is at once the range is applied
+} delta_range;
+
+// Finds the retained records that take a client from `opts->since` to the
+// end of the log. Caller holds log_lock. Fails if the version has been
+// pruned or the client's checksum does not match the server's history.
+static bool find_delta(hosted_doc *d, const handshake_opts *opts, delta_range *out)
+{
+    const log_index *idx = d->log_index;
+    size_t next = log_index_lower_bound(idx, opts->since + 1);
+    const log_record *at = next > idx->first_id ? log_index_get(idx, next - 1) : NULL;
+
+    uint64_t expected;
+    if (at && at->version == opts->since)
+        expected = at->checksum;
+    else if (!at && idx->first_id == 0)
+        expected = snapshot_checksum("", 0); // before the first record
+    else
+        return false;
+
+    if (expected != opts->checksum)
+        return false;
+
+    const log_record *first = log_index_get(idx, next);
+    const log_record *last = log_index_get(idx, idx->first_id + idx->count - 1);
+    out->to = d->log->total_len;
+    out->from = first ? first->offset : out->to;
+    out->version = first ? last->version : opts->since;
+    return true;
+}
+
+static int send_snapshot(client_info *c, int fd_c2s, const handshake_opts *opts,
+                         shared_snapshot *snap, uint64_t version)
+{
+    if (!snap)
+        return -1;
+
+    int rc = 0;
+    bool mapped = false;
+
+    if (opts->map_snapshot)
     {
-        *role_out = NULL;
-        return;
+        dprintf(c->fd_s2c, "%s\n%llu\nMAP %d %d %zu\n", c->permission,
+                (unsigned long long)version, (int)getpid(), snap->fd, snap->len);
+
+        // The client must finish mapping before our reference is dropped;
+        // "COPY" asks for the bytes inline instead.
+        char *ack = read_line_dynamic(fd_c2s);
+        if (!ack)
+            rc = -1;
+        else
+            mapped = strcmp(ack, "MAPPED") == 0;
+        free(ack);
+
+        if (rc == 0 && !mapped)
+            dprintf(c->fd_s2c, "%zu\n", snap->len);
+    }
+    else
+    {
+        dprintf(c->fd_s2c, "%s\n%llu\n%zu\n", c->permission,
+                (unsigned long long)version, snap->len);
     }
 
-    char *line = NULL;
-    size_t len = 0;
-    while (getline(&line, &len, f) != -1)
+    if (rc == 0 && !mapped)
+        rc = send_file_range(c->fd_s2c, snap->fd, 0, snap->len);
+
+    shared_snapshot_release(snap);
+    return rc;
+}
+
+int send_bootstrap(hosted_doc *d, client_info *c, int fd_c2s, const handshake_opts *opts)
+{
+    // Registering as pending and pinning what we send happen under the
+    // client's lock, so each broadcast is either covered by the
+    // bootstrap or queued in the backlog. A broadcast whose pass began
+    // before the registration was published after our view.
+    pthread_mutex_lock(&c->lock);
+    c->pending = true;
+    c->handle = client_registry_add(d->clients, c);
+
+    doc_view *view = doc_view_acquire(d);
+    log_span span = {0};
+    uint64_t delta_version = 0;
+    bool use_delta = false;
+    if (opts->resume)
     {
-        char *saveptr = NULL;
-        char *user = strtok_r(line, " \t\r\n", &saveptr);
-        char *role = strtok_r(NULL, " \t\r\n", &saveptr);
-        if (!user || !role)
-            continue;
-        if (strcmp(trim(user), *username_out) == 0 &&
-            (strcmp(role, "read") == 0 || strcmp(role, "write") == 0))
+        pthread_rwlock_rdlock(&d->log_lock);
+        delta_range delta;
+        // Replaying more than the document itself saves nothing
+        use_delta = find_delta(d, opts, &delta) && delta.to - delta.from <= view->len;
+        if (use_delta)
         {
-            *role_out = strdup(trim(role));
-            fclose(f);
-            free(line);
-            return;
+            segment_log_pin(d->log, delta.from, delta.to, &span);
+            c->resume_offset = delta.to;
+            delta_version = delta.version;
         }
+        pthread_rwlock_unlock(&d->log_lock);
     }
+    pthread_mutex_unlock(&c->lock);
 
-    free(line);
-    fclose(f);
-    *role_out = NULL;
+    int rc;
+    if (use_delta)
+    {
+        // The span keeps its segments open even if retention drops them
+        dprintf(c->fd_s2c, "%s\n%llu\nDELTA %llu\n", c->permission,
+                (unsigned long long)delta_version,
+                (unsigned long long)(span.to - span.from));
+        rc = log_span_stream(&span, c->fd_s2c, span.from, span.to);
+        log_span_release(&span);
+    }
+    else
+    {
+        pthread_mutex_lock(&d->snapshot_cache_mutex);
+        shared_snapshot *snap = shared_snapshot_acquire(&d->snapshot_cache, view->data,
+                                                        view->len, view->version);
+        pthread_mutex_unlock(&d->snapshot_cache_mutex);
+        rc = send_snapshot(c, fd_c2s, opts, snap, view->version);
+    }
+    doc_view_release(view);
+
+    pthread_mutex_lock(&c->lock);
+    if (c->backlog_len)
+        write_all(c->fd_s2c, c->backlog, c->backlog_len);
+    free(c->backlog);
+    c->backlog = NULL;
+    c->backlog_len = c->backlog_cap = 0;
+    c->pending = false;
+    pthread_mutex_unlock(&c->lock);
+
+    return rc;
 }
 
-void insert_sorted_cmd(cmd_ipc *cmd)
+void register_cmd_queue(hosted_doc *d, cmd_queue *q)
 {
-    pthread_mutex_lock(&cmd_list_mutex);
-    append_to(global_cmd_list, cmd);
-    int i = global_cmd_list->size - 1;
-    while (i > 0)
+    pthread_mutex_lock(&d->cmd_queue_mutex);
+    append_to(d->cmd_queues, q);
+    pthread_mutex_unlock(&d->cmd_queue_mutex);
+}
+
+void enqueue_cmd(cmd_queue *q, cmd_ipc *cmd)
+{
+    static atomic_uint_fast64_t next_seq = 0;
+
+    gettimeofday(&cmd->timestamp, NULL);
+    cmd->seq = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+
+    // Counted before the push so the tick never drains an uncounted command
+    tick_scheduler_note_enqueue(&scheduler, strlen(cmd->raw_command));
+    cmd_queue_push(q, cmd);
+}
+
+size_t collect_cmd_batch(hosted_doc *d)
+{
+    pthread_mutex_lock(&d->cmd_queue_mutex);
+
+    // A queue closed before the drain can receive nothing afterwards,
+    // so it is safe to release once merged.
+    array_list *closed = create_array(4);
+    for (size_t i = 0; i < d->cmd_queues->size; i++)
+    {
+        cmd_queue *q = get_from(d->cmd_queues, i);
+        if (cmd_queue_is_closed(q))
+            append_to(closed, q);
+    }
+
+    cmd_queue_merge(d->cmd_queues, d->cmd_carry, d->cmd_list);
+
+    for (size_t i = 0; i < closed->size; i++)
     {
-        cmd_ipc *curr = get_from(global_cmd_list, i);
-        cmd_ipc *prev = get_from(global_cmd_list, i - 1);
-        int earlier = (curr->timestamp.tv_sec < prev->timestamp.tv_sec) ||
-                      (curr->timestamp.tv_sec == prev->timestamp.tv_sec &&
-                       curr->timestamp.tv_usec < prev->timestamp.tv_usec);
-        if (!earlier)
-            break;
-        global_cmd_list->data[i] = prev;
-        global_cmd_list->data[i - 1] = curr;
-        i--;
+        cmd_queue *q = get_from(closed, i);
+        remove_from(d->cmd_queues, q);
+        cmd_queue_free(q);
     }
-    pthread_mutex_unlock(&cmd_list_mutex);
+    closed->size = 0;
+    free_array(closed);
+
+    pthread_mutex_unlock(&d->cmd_queue_mutex);
+
+    // Held-back commands stay counted as pending by the scheduler
+    return throttle_admit(d->throttle, d->cmd_list, d->cmd_carry);
 }
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+
+// Load generator for `make bench`. Forks simulated clients that run the
+// real signal/FIFO handshake; writers submit edits at a fixed rate and
+// time each one from submit until its EDIT line comes back in a
+// broadcast, readers only drain broadcasts. Results are merged through
+// a shared mapping and reported by the parent.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "histogram.h"
+#include "memory.h"
+
+#define MIX_KINDS 4 // insert, delete, inline, block
+#define DRAIN_MS 2000
+
+typedef struct bench_config
+{
+    pid_t server_pid;
+    const char *server_path; // spawned in a scratch directory when set
+    unsigned long interval_ms;
+    size_t clients;
+    double write_share;
+    double rate; // commands per second per writer
+    double duration_s;
+    unsigned mix[MIX_KINDS];
+    const char *doc;
+} bench_config;
+
+// One per simulated client, in memory shared with the parent
+typedef struct client_result
+{
+    histogram latency_ns;
+    uint64_t sent;
+    uint64_t seen;
+    uint64_t rejected;
+    uint64_t bytes;
+    bool connected;
+} client_result;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// === Simulated client ===
+
+typedef struct sim_client
+{
+    const bench_config *cfg;
+    client_result *result;
+    char username[32];
+    bool writer;
+    int fd_c2s;
+    int fd_s2c;
+
+    // Submit times of commands not yet seen in a broadcast, oldest first.
+    // The server keeps each user's commands in order, so EDIT lines for
+    // this user retire them front to back.
+    pthread_mutex_t lock;
+    uint64_t *inflight;
+    size_t head;
+    size_t count;
+    size_t cap;
+    bool done_sending;
+} sim_client;
+
+static void inflight_push(sim_client *s, uint64_t t)
+{
+    pthread_mutex_lock(&s->lock);
+    if (s->count == s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 256;
+        uint64_t *q = Calloc(cap, sizeof(uint64_t));
+        for (size_t i = 0; i < s->count; i++)
+            q[i] = s->inflight[(s->head + i) % s->cap];
+        free(s->inflight);
+        s->inflight = q;
+        s->cap = cap;
+        s->head = 0;
+    }
+    s->inflight[(s->head + s->count) % s->cap] = t;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static bool inflight_pop(sim_client *s, uint64_t *t)
+{
+    pthread_mutex_lock(&s->lock);
+    bool ok = s->count > 0;
+    if (ok)
+    {
+        *t = s->inflight[s->head];
+        s->head = (s->head + 1) % s->cap;
+        s->count--;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+static void pick_command(const bench_config *cfg, unsigned *seed, char *out, size_t cap)
+{
+    unsigned total = 0;
+    for (int i = 0; i < MIX_KINDS; i++)
+        total += cfg->mix[i];
+
+    unsigned r = total ? (unsigned)rand_r(seed) % total : 0;
+    int kind = 0;
+    while (kind < MIX_KINDS - 1 && r >= cfg->mix[kind])
+        r -= cfg->mix[kind++];
+
+    static const char *inline_ops[] = {"BOLD", "ITALIC", "CODE"};
+    static const char *block_ops[] = {"NEWLINE 0", "HEADING 1 0", "BLOCKQUOTE 0", "UNORDERED_LIST 0"};
+
+    switch (kind)
+    {
+    case 0:
+        snprintf(out, cap, "INSERT 0 %c%c", 'a' + rand_r(seed) % 26, 'a' + rand_r(seed) % 26);
+        break;
+    case 1:
+        snprintf(out, cap, "DEL 0 1");
+        break;
+    case 2:
+        snprintf(out, cap, "%s 0 2", inline_ops[rand_r(seed) % 3]);
+        break;
+    default:
+        snprintf(out, cap, "%s", block_ops[rand_r(seed) % 4]);
+        break;
+    }
+}
+
+static void *sender_thread(void *arg)
+{
+    sim_client *s = arg;
+    const bench_config *cfg = s->cfg;
+    unsigned seed = (unsigned)getpid();
+
+    uint64_t start = now_ns();
+    uint64_t stop = start + (uint64_t)(cfg->duration_s * 1e9);
+    uint64_t period = (uint64_t)(1e9 / cfg->rate);
+    char cmd[64];
+
+    // Absolute schedule, so a slow write does not lower the offered rate
+    for (uint64_t next = start; next < stop; next += period)
+    {
+        struct timespec ts = {(time_t)(next / 1000000000ull), (long)(next % 1000000000ull)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        pick_command(cfg, &seed, cmd, sizeof(cmd));
+        inflight_push(s, now_ns());
+        if (dprintf(s->fd_c2s, "%s\n", cmd) < 0)
+            break;
+        s->result->sent++;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->done_sending = true;
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static char *read_line(int fd)
+{
+    size_t len = 0, cap = 64;
+    char *line = Calloc(cap, 1);
+    char ch;
+    while (read(fd, &ch, 1) == 1)
+    {
+        if (ch == '\n')
+            return line;
+        if (len + 1 == cap)
+        {
+            cap *= 2;
+            line = realloc(line, cap);
+        }
+        line[len++] = ch;
+        line[len] = '\0';
+    }
+    free(line);
+    return NULL;
+}
+
+static int handshake(sim_client *s, pid_t server_pid)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN + 1);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    if (kill(server_pid, SIGRTMIN) != 0)
+        return -1;
+    int sig;
+    sigwait(&set, &sig);
+
+    char c2s[64], s2c[64];
+    snprintf(c2s, sizeof(c2s), "FIFO_C2S_%d", (int)getpid());
+    snprintf(s2c, sizeof(s2c), "FIFO_S2C_%d", (int)getpid());
+    s->fd_c2s = open(c2s, O_WRONLY);
+    s->fd_s2c = open(s2c, O_RDONLY);
+    if (s->fd_c2s < 0 || s->fd_s2c < 0)
+        return -1;
+
+    if (s->cfg->doc)
+        dprintf(s->fd_c2s, "%s doc=%s\n", s->username, s->cfg->doc);
+    else
+        dprintf(s->fd_c2s, "%s\n", s->username);
+
+    char *role = read_line(s->fd_s2c);
+    char *version = role ? read_line(s->fd_s2c) : NULL;
+    char *length = version ? read_line(s->fd_s2c) : NULL;
+    bool ok = length && strncmp(role, "Reject", 6) != 0;
+
+    // Skip the snapshot
+    size_t left = ok ? (size_t)strtoull(length, NULL, 10) : 0;
+    char buf[4096];
+    while (left > 0)
+    {
+        ssize_t n = read(s->fd_s2c, buf, left < sizeof(buf) ? left : sizeof(buf));
+        if (n <= 0)
+        {
+            ok = false;
+            break;
+        }
+        left -= (size_t)n;
+    }
+
+    free(role);
+    free(version);
+    free(length);
+    return ok ? 0 : -1;
+}
+
+// Retires this user's EDIT lines from the in-flight queue
+static void scan_broadcast(sim_client *s, const char *line, size_t len)
+{
+    size_t ulen = strlen(s->username);
+    if (len < 5 + ulen + 1 || strncmp(line, "EDIT ", 5) != 0 ||
+        strncmp(line + 5, s->username, ulen) != 0 || line[5 + ulen] != ' ')
+        return;
+
+    uint64_t submitted;
+    if (!inflight_pop(s, &submitted))
+        return;
+    histogram_record(&s->result->latency_ns, now_ns() - submitted);
+    s->result->seen++;
+    if (memmem(line, len, " Reject", 7))
+        s->result->rejected++;
+}
+
+static void run_client(const bench_config *cfg, client_result *result, size_t id, bool writer)
+{
+    sim_client s = {0};
+    s.cfg = cfg;
+    s.result = result;
+    s.writer = writer;
+    pthread_mutex_init(&s.lock, NULL);
+    snprintf(s.username, sizeof(s.username), "bench_%c%zu", writer ? 'w' : 'r', id);
+
+    if (handshake(&s, cfg->server_pid) != 0)
+        _exit(1);
+    result->connected = true;
+
+    pthread_t sender;
+    if (writer)
+        pthread_create(&sender, NULL, sender_thread, &s);
+
+    size_t cap = 1 << 16, len = 0;
+    char *buf = Calloc(cap, 1);
+    uint64_t drain_deadline = 0;
+    uint64_t stop = now_ns() + (uint64_t)(cfg->duration_s * 1e9);
+
+    while (1)
+    {
+        pthread_mutex_lock(&s.lock);
+        bool finished = writer ? s.done_sending && s.count == 0 : now_ns() >= stop;
+        bool sending_over = !writer || s.done_sending;
+        pthread_mutex_unlock(&s.lock);
+        if (finished)
+            break;
+        if (sending_over && !drain_deadline)
+            drain_deadline = now_ns() + (uint64_t)DRAIN_MS * 1000000;
+        if (drain_deadline && now_ns() >= drain_deadline)
+            break;
+
+        struct pollfd pfd = {s.fd_s2c, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+
+        if (len == cap)
+        {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+        ssize_t n = read(s.fd_s2c, buf + len, cap - len);
+        if (n <= 0)
+            break;
+        result->bytes += (uint64_t)n;
+        len += (size_t)n;
+
+        // Consume whole lines, keep a partial one
+        size_t start = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (buf[i] != '\n')
+                continue;
+            if (writer)
+                scan_broadcast(&s, buf + start, i - start);
+            start = i + 1;
+        }
+        memmove(buf, buf + start, len - start);
+        len -= start;
+    }
+
+    if (writer)
+        pthread_join(sender, NULL);
+    dprintf(s.fd_c2s, "DISCONNECT\n");
+    close(s.fd_c2s);
+    close(s.fd_s2c);
+    free(buf);
+    free(s.inflight);
+    _exit(0);
+}
+
+// === Scratch server ===
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static pid_t spawn_server(const bench_config *cfg, char *dir, int *stdin_fd)
+{
+    char exe[PATH_MAX];
+    if (!realpath(cfg->server_path, exe))
+        return -1;
+    if (!mkdtemp(dir) || chdir(dir) != 0)
+        return -1;
+
+    FILE *roles = fopen("roles.txt", "w");
+    if (!roles)
+        return -1;
+    for (size_t i = 0; i < cfg->clients; i++)
+        fprintf(roles, "bench_w%zu write\nbench_r%zu read\n", i, i);
+    fclose(roles);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+
+    char interval[32];
+    snprintf(interval, sizeof(interval), "%lu", cfg->interval_ms);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(exe, exe, interval, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+    *stdin_fd = fds[1];
+
+    // Let it install its SIGRTMIN handler
+    nanosleep(&(struct timespec){0, 200 * 1000000}, NULL);
+    return pid;
+}
+
+// === Main ===
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s (--server=PATH | <server_pid>) [options]\n"
+            "  --server=PATH       spawn this server in a scratch directory\n"
+            "  --interval=MS       tick interval for a spawned server (50)\n"
+            "  --clients=N         simulated clients (16)\n"
+            "  --writers=F         share of clients with the write role (0.75)\n"
+            "  --rate=N            commands per second per writer (50)\n"
+            "  --duration=S        seconds of load (5)\n"
+            "  --mix=I,D,L,B       weights of insert, delete, inline, block edits (60,20,10,10)\n"
+            "  --doc=NAME          document to edit (the default one)\n"
+            "Attaching to a running server needs bench_w<i>/bench_r<i> in its\n"
+            "roles.txt and must run in the server's working directory.\n",
+            prog);
+}
+
+static int parse_args(bench_config *cfg, int argc, char *argv[])
+{
+    *cfg = (bench_config){.interval_ms = 50, .clients = 16, .write_share = 0.75,
+                          .rate = 50, .duration_s = 5, .mix = {60, 20, 10, 10}};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        if (strncmp(a, "--server=", 9) == 0)
+            cfg->server_path = a + 9;
+        else if (strncmp(a, "--interval=", 11) == 0)
+            cfg->interval_ms = strtoul(a + 11, NULL, 10);
+        else if (strncmp(a, "--clients=", 10) == 0)
+            cfg->clients = strtoul(a + 10, NULL, 10);
+        else if (strncmp(a, "--writers=", 10) == 0)
+            cfg->write_share = strtod(a + 10, NULL);
+        else if (strncmp(a, "--rate=", 7) == 0)
+            cfg->rate = strtod(a + 7, NULL);
+        else if (strncmp(a, "--duration=", 11) == 0)
+            cfg->duration_s = strtod(a + 11, NULL);
+        else if (strncmp(a, "--doc=", 6) == 0)
+            cfg->doc = a + 6;
+        else if (strncmp(a, "--mix=", 6) == 0)
+        {
+            if (sscanf(a + 6, "%u,%u,%u,%u", &cfg->mix[0], &cfg->mix[1], &cfg->mix[2],
+                       &cfg->mix[3]) != MIX_KINDS)
+                return -1;
+        }
+        else if (a[0] != '-' && !cfg->server_pid)
+            cfg->server_pid = (pid_t)strtol(a, NULL, 10);
+        else
+            return -1;
+    }
+
+    if ((!cfg->server_path) == (!cfg->server_pid))
+        return -1;
+    if (cfg->clients == 0 || cfg->rate <= 0 || cfg->duration_s <= 0 ||
+        cfg->write_share < 0 || cfg->write_share > 1)
+        return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_config cfg;
+    if (parse_args(&cfg, argc, argv) != 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN); // a dead server shows up as write errors
+    char dir[] = "/tmp/bench.XXXXXX";
+    int server_stdin = -1;
+    if (cfg.server_path)
+    {
+        cfg.server_pid = spawn_server(&cfg, dir, &server_stdin);
+        if (cfg.server_pid <= 0)
+        {
+            perror("spawn server");
+            return 1;
+        }
+    }
+
+    client_result *results = mmap(NULL, cfg.clients * sizeof(client_result),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    size_t writers = (size_t)(cfg.write_share * (double)cfg.clients + 0.5);
+    pid_t *pids = Calloc(cfg.clients, sizeof(pid_t));
+    uint64_t started = now_ns();
+
+    for (size_t i = 0; i < cfg.clients; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+            run_client(&cfg, &results[i], i, i < writers);
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < cfg.clients; i++)
+    {
+        int status;
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    double elapsed = (double)(now_ns() - started) / 1e9;
+
+    if (server_stdin >= 0)
+    {
+        // QUIT? is refused until the server has reaped every client
+        // thread, which lags the DISCONNECTs slightly
+        for (int tries = 0; waitpid(cfg.server_pid, NULL, WNOHANG) == 0; tries++)
+        {
+            if (tries == 50)
+                kill(cfg.server_pid, SIGKILL);
+            else
+                dprintf(server_stdin, "QUIT?\n");
+            nanosleep(&(struct timespec){0, 100 * 1000000}, NULL);
+        }
+        close(server_stdin);
+        if (chdir("/") == 0)
+            nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    histogram latency = {0};
+    uint64_t sent = 0, seen = 0, rejected = 0, bytes = 0;
+    for (size_t i = 0; i < cfg.clients; i++)
+    {
+        histogram_merge(&latency, &results[i].latency_ns);
+        sent += results[i].sent;
+        seen += results[i].seen;
+        rejected += results[i].rejected;
+        bytes += results[i].bytes;
+    }
+
+    printf("clients=%zu writers=%zu readers=%zu failed=%zu rate=%.0f/s per writer duration=%.1fs\n",
+           cfg.clients, writers, cfg.clients - writers, failed, cfg.rate, cfg.duration_s);
+    printf("sent=%llu seen=%llu rejected=%llu throughput=%.1f cmd/s\n", (unsigned long long)sent,
+           (unsigned long long)seen, (unsigned long long)rejected, (double)seen / cfg.duration_s);
+    printf("latency_us p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+           (double)histogram_quantile(&latency, 0.5) / 1e3,
+           (double)histogram_quantile(&latency, 0.9) / 1e3,
+           (double)histogram_quantile(&latency, 0.99) / 1e3,
+           (double)histogram_quantile(&latency, 0.999) / 1e3, (double)latency.max / 1e3);
+    printf("broadcast_bytes=%llu (%.2f MB/s over %.1fs)\n", (unsigned long long)bytes,
+           (double)bytes / elapsed / 1e6, elapsed);
+
+    munmap(results, cfg.clients * sizeof(client_result));
+    free(pids);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#define BUILD_CLIENT
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "local_echo.h"
+#include "ipc_helpers.h"
+#include "markdown.h"
+#include "memory.h"
+
+local_echo *local_echo_create(bool enabled)
+{
+    local_echo *e = Calloc(1, sizeof(local_echo));
+    e->pending = create_array(16);
+    e->enabled = enabled;
+    return e;
+}
+
+static void drop_view(local_echo *e)
+{
+    if (e->view)
+        markdown_free(e->view);
+    e->view = NULL;
+}
+
+void local_echo_free(local_echo *e)
+{
+    if (!e)
+        return;
+    drop_view(e);
+    free_array(e->pending);
+    free(e);
+}
+
+void local_echo_push(local_echo *e, const char *line)
+{
+    if (!e->enabled)
+        return;
+
+    // The server trims the same way before logging the command
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+        len--;
+
+    append_to(e->pending, strndup(line, len));
+    drop_view(e);
+}
+
+// Length of <cmd> in "<cmd> <result>", where the result is SUCCESS or
+// "Reject <REASON>"
+static size_t strip_result(const char *cmd, size_t len)
+{
+    size_t sp = len;
+    while (sp > 0 && cmd[sp - 1] != ' ')
+        sp--;
+    if (sp == 0)
+        return len;
+    if (len - sp == 7 && memcmp(cmd + sp, "SUCCESS", 7) == 0)
+        return sp - 1;
+
+    // Back over "Reject" too
+    sp--;
+    while (sp > 0 && cmd[sp - 1] != ' ')
+        sp--;
+    return sp ? sp - 1 : len;
+}
+
+// Index of the held command that "EDIT <user> <cmd> <result>" acks, or -1.
+// The whole command has to match, or "INSERT 1 a" would ack "INSERT 1 a b".
+static int find_acked(local_echo *e, const char *cmd, size_t len)
+{
+    len = strip_result(cmd, len);
+    for (size_t i = 0; i < e->pending->size; i++)
+    {
+        const char *held = get_from(e->pending, i);
+        if (strlen(held) == len && memcmp(cmd, held, len) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+void local_echo_ack(local_echo *e, const char *msg, size_t len, const char *username)
+{
+    if (e->pending->size == 0)
+        return;
+
+    size_t user_len = strlen(username);
+    const char *end = msg + len;
+
+    for (const char *line = msg; line < end;)
+    {
+        const char *nl = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = nl ? nl : end;
+
+        if ((size_t)(line_end - line) > 6 + user_len && strncmp(line, "EDIT ", 5) == 0 &&
+            memcmp(line + 5, username, user_len) == 0 && line[5 + user_len] == ' ')
+        {
+            const char *cmd = line + 6 + user_len;
+            int i = find_acked(e, cmd, (size_t)(line_end - cmd));
+
+            // Commands are applied in the order they were sent, so anything
+            // held before the acked one will not be acked any more
+            if (i >= 0)
+                drop_view(e);
+            for (; i >= 0; i--)
+                free(remove_at(e->pending, 0));
+        }
+        line = line_end + 1;
+    }
+}
+
+void local_echo_reset(local_echo *e)
+{
+    e->pending = clear_array(e->pending);
+    drop_view(e);
+}
+
+void local_echo_rebase(local_echo *e)
+{
+    drop_view(e);
+}
+
+document *local_echo_view(local_echo *e, document *base, const char *role)
+{
+    // Nothing held: the base is the view, so there is nothing to copy
+    if (e->pending->size == 0)
+    {
+        drop_view(e);
+        return base;
+    }
+    if (e->view)
+        return e->view;
+
+    // A private copy of the base, with every held command in one batch.
+    // Adopted lazily, so only the lines the held commands touch are
+    // parsed; the rest is copied through by the commit's flatten.
+    document *view = markdown_init();
+    char *copy = Calloc(base->snapshot_len + 1, sizeof(char));
+    if (base->snapshot)
+        memcpy(copy, base->snapshot, base->snapshot_len);
+    adopt_snapshot_lazily(view, copy, base->snapshot_len);
+
+    for (size_t i = 0; i < e->pending->size; i++)
+    {
+        cmd_ipc c = {.raw_command = get_from(e->pending, i), .role = (char *)role};
+        process_raw_command(view, &c);
+    }
+    markdown_increment_version(view);
+
+    e->view = view;
+    return view;
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log_index.h"
+#include "memory.h"
+
+static void free_posting_list(void *ptr)
+{
+    posting_list *p = ptr;
+    free(p->ids);
+    free(p);
+}
+
+static void posting_add(posting_list *p, size_t id)
+{
+    // A record with several edits by one user is posted once
+    if (p->count && p->ids[p->count - 1] == id)
+        return;
+
+    if (p->count == p->cap)
+    {
+        p->cap = p->cap ? p->cap * 2 : 8;
+        p->ids = realloc(p->ids, p->cap * sizeof(size_t));
+    }
+    p->ids[p->count++] = id;
+}
+
+log_index *log_index_create(bool track_users)
+{
+    log_index *idx = Calloc(1, sizeof(log_index));
+    idx->cap = 256;
+    idx->records = Calloc(idx->cap, sizeof(log_record));
+    idx->track_users = track_users;
+    if (track_users)
+        idx->users = hash_map_create(16);
+    return idx;
+}
+
+void log_index_free(log_index *idx)
+{
+    if (!idx)
+        return;
+    free(idx->records);
+    hash_map_free(idx->users, free_posting_list);
+    free(idx);
+}
+
+static void index_users(log_index *idx, size_t id, const char *data, size_t len)
+{
+    const char *end = data + len;
+    const char *line = data;
+    char name[256];
+
+    while (line < end)
+    {
+        const char *eol = memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+
+        // EDIT <user> <command...> <result>
+        if (eol - line > 5 && strncmp(line, "EDIT ", 5) == 0)
+        {
+            const char *user = line + 5;
+            const char *sp = memchr(user, ' ', eol - user);
+            size_t n = sp ? (size_t)(sp - user) : (size_t)(eol - user);
+            if (n > 0 && n < sizeof(name))
+            {
+                memcpy(name, user, n);
+                name[n] = '\0';
+
+                posting_list *p = hash_map_get(idx->users, name);
+                if (!p)
+                {
+                    p = Calloc(1, sizeof(posting_list));
+                    hash_map_put(idx->users, name, p);
+                }
+                posting_add(p, id);
+            }
+        }
+        line = eol + 1;
+    }
+}
+
+void log_index_add(log_index *idx, uint64_t version, uint64_t checksum,
+                   uint64_t offset, const char *data, size_t len)
+{
+    if (idx->count == idx->cap)
+    {
+        idx->cap *= 2;
+        idx->records = realloc(idx->records, idx->cap * sizeof(log_record));
+    }
+
+    size_t id = idx->first_id + idx->count;
+    idx->records[idx->count++] = (log_record){version, offset, len, checksum};
+
+    if (idx->track_users)
+        index_users(idx, id, data, len);
+}
+
+void log_index_prune(log_index *idx, uint64_t base_offset)
+{
+    size_t k = 0;
+    while (k < idx->count && idx->records[k].offset < base_offset)
+        k++;
+    if (k == 0)
+        return;
+
+    memmove(idx->records, idx->records + k, (idx->count - k) * sizeof(log_record));
+    idx->count -= k;
+    idx->first_id += k;
+
+    if (!idx->track_users)
+        return;
+
+    for (size_t i = 0; i < idx->users->capacity; i++)
+    {
+        posting_list *p = idx->users->entries[i].value;
+        if (!idx->users->entries[i].key || !p)
+            continue;
+
+        size_t drop = 0;
+        while (drop < p->count && p->ids[drop] < idx->first_id)
+            drop++;
+        memmove(p->ids, p->ids + drop, (p->count - drop) * sizeof(size_t));
+        p->count -= drop;
+    }
+}
+
+size_t log_index_lower_bound(const log_index *idx, uint64_t version)
+{
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->records[mid].version < version)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return idx->first_id + lo;
+}
+
+const log_record *log_index_get(const log_index *idx, size_t id)
+{
+    if (id < idx->first_id || id - idx->first_id >= idx->count)
+        return NULL;
+    return &idx->records[id - idx->first_id];
+}
+
+const posting_list *log_index_user(const log_index *idx, const char *username)
+{
+    if (!idx->track_users)
+        return NULL;
+    return hash_map_get(idx->users, username);
+}
@@ -2,8 +2,11 @@
 #include "memory.h"
 #include "document.h"
 #include "array_list.h"
+#include "trace.h"
 #include <string.h>
+#include <sys/mman.h>
 #include <stdbool.h>
+#include <time.h>
 
 #define SUCCESS 0
 #define INVALID_CURSOR_POS -1
@@ -20,6 +23,10 @@ document *markdown_init(void)
 
     doc->snapshot = NULL;
     doc->snapshot_len = 0;
+    doc->snapshot_hash = 0;
+    doc->line_marks = Calloc(1, sizeof(line_mark));
+    doc->snapshot_marks = 1;
+    doc->snapshot_lines = 0;
 
     doc->meta_log = create_array(64);
     doc->cmd_list = create_array(64);
@@ -28,6 +35,17 @@ document *markdown_init(void)
     return doc;
 }
 
+// A snapshot mapped from the server is unmapped rather than freed
+static void release_lazy_base(document *doc)
+{
+    if (doc->lazy_mapped)
+        munmap(doc->lazy_base, doc->lazy_mapped);
+    else
+        free(doc->lazy_base);
+    doc->lazy_base = NULL;
+    doc->lazy_mapped = 0;
+}
+
 void markdown_free(document *doc)
 {
     if (!doc)
@@ -41,11 +59,16 @@ void markdown_free(document *doc)
         free_chunk(temp);
     }
 
-    free(doc->snapshot);
+    if (doc->snapshot != doc->lazy_base)
+        free(doc->snapshot);
+    release_lazy_base(doc);
+    free(doc->line_marks);
 
     free_array(doc->meta_log);
     free_array(doc->cmd_list);
     free_array(doc->deleted_ranges);
+    if (doc->splices)
+        free_array(doc->splices);
 
     free(doc);
 }
@@ -318,19 +341,35 @@ char *markdown_flatten(const document *doc)
 
 // === Versioning ===
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 void markdown_increment_version(document *doc)
 {
     if (!doc)
         return;
 
+    uint64_t t0 = now_ns();
+
     // 1. Apply all deletions
+    TRACE_BEGIN("commit_deletes");
     for (size_t i = 0; i < doc->deleted_ranges->size; ++i)
     {
         range *r = (range *)get_from(doc->deleted_ranges, i);
+        TRACE_BEGIN("naive_delete");
         naive_delete(doc, r->start, r->end - r->start);
+        TRACE_END("naive_delete");
     }
+    TRACE_END("commit_deletes");
+
+    uint64_t t1 = now_ns();
 
     // 2. Apply all insertions
+    TRACE_BEGIN("commit_inserts");
     for (size_t i = 0; i < doc->cmd_list->size; ++i)
     {
         cmd *c = (cmd *)get_from(doc->cmd_list, i);
@@ -338,59 +377,93 @@ void markdown_increment_version(document *doc)
         switch (c->type)
         {
         case CMD_INSERT:
+            TRACE_BEGIN("naive_insert");
             naive_insert(doc, c->snap_pos, c->content);
+            TRACE_END("naive_insert");
             break;
 
         case CMD_NEWLINE:
+            TRACE_BEGIN("naive_newline");
             naive_newline(doc, c->snap_pos);
+            TRACE_END("naive_newline");
             break;
 
         case CMD_BLOCK_HEADING:
+            TRACE_BEGIN("naive_heading");
             naive_heading(doc, c->heading_level, c->snap_pos);
+            TRACE_END("naive_heading");
             break;
 
         case CMD_BLOCK_BLOCKQUOTE:
+            TRACE_BEGIN("naive_blockquote");
             naive_blockquote(doc, c->snap_pos);
+            TRACE_END("naive_blockquote");
             break;
 
         case CMD_BLOCK_OL_ITEM:
+            TRACE_BEGIN("naive_ordered_list");
             naive_ordered_list(doc, c->snap_pos);
+            TRACE_END("naive_ordered_list");
             break;
 
         case CMD_BLOCK_UL_ITEM:
+            TRACE_BEGIN("naive_unordered_list");
             naive_unordered_list(doc, c->snap_pos);
+            TRACE_END("naive_unordered_list");
             break;
 
         case CMD_BLOCK_HRULE:
+            TRACE_BEGIN("naive_horizontal_rule");
             naive_horizontal_rule(doc, c->snap_pos);
+            TRACE_END("naive_horizontal_rule");
             break;
 
         case CMD_INLINE_BOLD:
+            TRACE_BEGIN("naive_bold");
             naive_bold(doc, c->snap_pos, c->end_pos);
+            TRACE_END("naive_bold");
             break;
 
         case CMD_INLINE_ITALIC:
+            TRACE_BEGIN("naive_italic");
             naive_italic(doc, c->snap_pos, c->end_pos);
+            TRACE_END("naive_italic");
             break;
 
         case CMD_INLINE_CODE:
+            TRACE_BEGIN("naive_code");
             naive_code(doc, c->snap_pos, c->end_pos);
+            TRACE_END("naive_code");
             break;
 
         case CMD_INLINE_LINK:
+            TRACE_BEGIN("naive_link");
             naive_link(doc, c->snap_pos, c->end_pos, c->content);
+            TRACE_END("naive_link");
             break;
 
         default:
             break;
         }
     }
+    TRACE_END("commit_inserts");
+
+    uint64_t t2 = now_ns();
 
     // 3. Flatten and commit new snapshot
-    if (doc->snapshot)
+    TRACE_BEGIN("commit_flatten");
+    if (doc->snapshot != doc->lazy_base)
         free(doc->snapshot);
     doc->snapshot = flatten_document(doc);
     doc->snapshot_len = doc->num_characters;
+    if (doc->lazy_base && !doc->lazy_spans)
+        release_lazy_base(doc);
+    TRACE_END("commit_flatten");
+
+    uint64_t t3 = now_ns();
+    doc->commit_delete_ns = t1 - t0;
+    doc->commit_insert_ns = t2 - t1;
+    doc->commit_flatten_ns = t3 - t2;
 
     // 4. Clear metadata
     doc->meta_log = clear_array(doc->meta_log);
@@ -1,12 +1,19 @@
 #include "memory.h"
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+static atomic_size_t calloc_calls = 0;
 
+size_t calloc_count(void)
+{
+    return atomic_load_explicit(&calloc_calls, memory_order_relaxed);
+}
 
 void *Calloc(size_t nmemb, size_t size)
 {
+    atomic_fetch_add_explicit(&calloc_calls, 1, memory_order_relaxed);
     void *ptr = calloc(nmemb, size);
     if (!ptr)
     {
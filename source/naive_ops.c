@@ -48,6 +48,7 @@ int naive_insert_raw(document *doc, size_t working_pos, size_t snapshot_pos, con
         doc->num_characters = content_size;
         doc->num_chunks++;
 
+        record_splice(doc, 0, 0, content, content_size);
         update_meta_log(doc->meta_log, snapshot_pos, content_size);
         return SUCCESS;
     }
@@ -60,6 +61,7 @@ int naive_insert_raw(document *doc, size_t working_pos, size_t snapshot_pos, con
 
     chunk_insert(curr, local_pos, content, content_size);
     doc->num_characters += content_size;
+    record_splice(doc, working_pos, 0, content, content_size);
 
     update_meta_log(doc->meta_log, snapshot_pos, content_size);
     return SUCCESS;
@@ -91,6 +93,8 @@ int naive_delete(document *doc, size_t pos, size_t len)
 
     /* 1) Locate & Analyze */
     size_t local_pos;
+    if (doc->lazy_spans)
+        locate_chunk(doc, pos + len, &local_pos); // parses the line the delete ends in
     Chunk *start = locate_chunk(doc, pos, &local_pos);
     if (!start)
         return INVALID_CURSOR_POS;
@@ -110,13 +114,15 @@ int naive_delete(document *doc, size_t pos, size_t len)
                 start->text + local_pos + len,
                 (start->len - (local_pos + len)) + 1);
         start->len -= len;
+        start->hashed = false;
         doc->num_characters -= len;
+        record_splice(doc, pos, len, "", 0);
 
         if (ol_damaged &&
             start->next &&
             start->next->type == ORDERED_LIST_ITEM)
         {
-            renumber_list_from(start->next);
+            renumber_list_from(doc, start->next);
         }
 
         update_meta_log(doc->meta_log, snapshot_pos, len);
@@ -136,7 +142,8 @@ int naive_delete(document *doc, size_t pos, size_t len)
     Chunk *curr = start->next;
     while (curr && to_delete >= curr->len)
     {
-        if (curr->type == ORDERED_LIST_ITEM)
+        if (curr->type == ORDERED_LIST_ITEM ||
+            (curr->type == LAZY_SPAN && span_has_ordered_item(curr)))
             ol_damaged = true;
 
         to_delete -= curr->len;
@@ -180,6 +187,7 @@ int naive_delete(document *doc, size_t pos, size_t len)
             start->text[local_pos] = '\0';
         }
         start->len = local_pos + suffix_len;
+        start->hashed = false;
 
         if (curr)
         {
@@ -218,12 +226,14 @@ int naive_delete(document *doc, size_t pos, size_t len)
         doc->num_chunks--;
     }
 
+    record_splice(doc, pos, total_deleted, "", 0);
+
     /* 5) Post‐Process OL renumbering */
     if (ol_damaged &&
         after_merge &&
         after_merge->type == ORDERED_LIST_ITEM)
     {
-        renumber_list_from(after_merge);
+        renumber_list_from(doc, after_merge);
     }
 
     update_meta_log(doc->meta_log, snapshot_pos, -(int)total_deleted);
@@ -263,6 +273,7 @@ int naive_newline_raw(document *doc, size_t working_pos, size_t snapshot_pos)
         doc->tail = new_chunk;
         doc->num_characters = 1;
         doc->num_chunks++;
+        record_splice(doc, 0, 0, "\n", 1);
 
         update_meta_log(doc->meta_log, snapshot_pos, 1);
         return SUCCESS;
@@ -294,11 +305,13 @@ int naive_newline_raw(document *doc, size_t working_pos, size_t snapshot_pos)
     curr->text[local_pos + 1] = '\0';
     curr->next = new;
     curr->len = local_pos + 1;
+    curr->hashed = false;
+    record_splice(doc, working_pos, 0, "\n", 1);
 
     if (new->next && new->next->type == ORDERED_LIST_ITEM)
     {
         new->next->index_OL = 1;
-        renumber_list_from(new->next);
+        renumber_list_from(doc, new->next);
     }
 
     update_meta_log(doc->meta_log, snapshot_pos, 1);
@@ -355,6 +368,7 @@ int naive_heading(document *doc, size_t level, size_t pos)
         doc->tail = new_chunk;
         doc->num_chunks = 1;
         doc->num_characters = prefix_len;
+        record_splice(doc, 0, 0, prefix, prefix_len);
 
         update_meta_log(doc->meta_log, snapshot_pos, prefix_len);
         return SUCCESS;
@@ -369,7 +383,9 @@ int naive_heading(document *doc, size_t level, size_t pos)
     memmove(curr->text + prefix_len, curr->text, curr->len + 1);
     memcpy(curr->text, prefix, prefix_len);
     curr->len += prefix_len;
+    curr->hashed = false;
     doc->num_characters += prefix_len;
+    record_splice(doc, pos, 0, prefix, prefix_len);
     curr->type = type;
     curr->index_OL = 0;
 
@@ -475,6 +491,7 @@ int naive_blockquote(document *doc, size_t pos)
         doc->tail = new_chunk;
         doc->num_chunks = 1;
         doc->num_characters = prefix_len;
+        record_splice(doc, 0, 0, prefix, prefix_len);
         update_meta_log(doc->meta_log, snapshot_pos, prefix_len);
         return SUCCESS;
     }
@@ -488,7 +505,9 @@ int naive_blockquote(document *doc, size_t pos)
     memmove(curr->text + prefix_len, curr->text, curr->len + 1);
     memcpy(curr->text, prefix, prefix_len);
     curr->len += prefix_len;
+    curr->hashed = false;
     doc->num_characters += prefix_len;
+    record_splice(doc, pos, 0, prefix, prefix_len);
 
     curr->type = type;
     curr->index_OL = 0;
@@ -536,6 +555,7 @@ int naive_ordered_list(document *doc, size_t pos)
         doc->num_chunks = 1;
         doc->num_characters = len;
 
+        record_splice(doc, 0, 0, text, len);
         update_meta_log(doc->meta_log, snapshot_pos, len);
         return SUCCESS;
     }
@@ -566,12 +586,14 @@ int naive_ordered_list(document *doc, size_t pos)
             curr->len + 1); // include '\0'
     memcpy(curr->text, prefix, prefix_len);
     curr->len += prefix_len;
+    curr->hashed = false;
     doc->num_characters += prefix_len;
+    record_splice(doc, pos, 0, prefix, prefix_len);
 
     // 4) Update metadata and renumber the rest
     curr->type = ORDERED_LIST_ITEM;
     curr->index_OL = my_index;
-    renumber_list_from(curr);
+    renumber_list_from(doc, curr);
 
     update_meta_log(doc->meta_log, snapshot_pos, prefix_len);
     return SUCCESS;
@@ -605,6 +627,7 @@ int naive_unordered_list(document *doc, size_t pos)
         doc->tail = new_chunk;
         doc->num_chunks = 1;
         doc->num_characters = prefix_len;
+        record_splice(doc, 0, 0, prefix, prefix_len);
 
         update_meta_log(doc->meta_log, snapshot_pos, prefix_len);
 
@@ -619,7 +642,9 @@ int naive_unordered_list(document *doc, size_t pos)
     memmove(curr->text + prefix_len, curr->text, curr->len + 1);
     memcpy(curr->text, prefix, prefix_len);
     curr->len += prefix_len;
+    curr->hashed = false;
     doc->num_characters += prefix_len;
+    record_splice(doc, pos, 0, prefix, prefix_len);
 
     curr->type = type;
     curr->index_OL = 0;
@@ -692,6 +717,7 @@ int naive_horizontal_rule(document *doc, size_t pos)
         doc->num_chunks = 1;
         doc->num_characters = len;
 
+        record_splice(doc, 0, 0, hr_text, len);
         update_meta_log(doc->meta_log, snapshot_pos, len);
         return SUCCESS;
     }
@@ -729,6 +755,7 @@ int naive_horizontal_rule(document *doc, size_t pos)
 
     doc->num_chunks++;
     doc->num_characters += hr_len;
+    record_splice(doc, pos, 0, hr_text, hr_len);
 
     update_meta_log(doc->meta_log, snapshot_pos, hr_len);
 
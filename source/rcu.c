@@ -0,0 +1,47 @@
+#include <sched.h>
+#include "rcu.h"
+
+void rcu_init(rcu_domain *d)
+{
+    atomic_init(&d->epoch, 0);
+    atomic_init(&d->readers[0], 0);
+    atomic_init(&d->readers[1], 0);
+    pthread_mutex_init(&d->writer, NULL);
+}
+
+void rcu_destroy(rcu_domain *d)
+{
+    pthread_mutex_destroy(&d->writer);
+}
+
+unsigned rcu_read_lock(rcu_domain *d)
+{
+    unsigned slot = atomic_load(&d->epoch) & 1;
+    atomic_fetch_add(&d->readers[slot], 1);
+    return slot;
+}
+
+void rcu_read_unlock(rcu_domain *d, unsigned slot)
+{
+    atomic_fetch_sub(&d->readers[slot], 1);
+}
+
+static void flip_and_drain(rcu_domain *d)
+{
+    unsigned old = atomic_fetch_add(&d->epoch, 1) & 1;
+    while (atomic_load(&d->readers[old]) != 0)
+        sched_yield();
+}
+
+void rcu_synchronize(rcu_domain *d)
+{
+    // A reader that can still hold the old pointer counted itself
+    // before it was unpublished, but on whichever slot its (possibly
+    // stale) epoch sample picked, so both slots must drain. Flipping
+    // before each wait sends newcomers to the other slot, so neither
+    // wait can be starved.
+    pthread_mutex_lock(&d->writer);
+    flip_and_drain(d);
+    flip_and_drain(d);
+    pthread_mutex_unlock(&d->writer);
+}
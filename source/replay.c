@@ -0,0 +1,456 @@
+// Replays a recorded server log against a fresh document, tick by tick.
+// Input is LOG? output or the log's .seg files in order. Each record is
+// one tick: its EDIT lines are re-parsed with the server's own
+// process_raw_command() and committed together, and the recorded
+// results and version are checked against what the engine does now.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "histogram.h"
+#include "ipc_helpers.h"
+#include "markdown.h"
+
+typedef struct replay_config
+{
+    const char *expect; // saved doc.md to compare against
+    const char *ticks;  // per-tick CSV
+    unsigned long pace_ms; // 0: as fast as possible
+    bool keep_going;       // continue past a version mismatch
+    const char **inputs;
+    int num_inputs;
+} replay_config;
+
+typedef struct replay_state
+{
+    document *doc;
+    uint64_t version;
+
+    uint64_t ticks;
+    uint64_t idle_ticks;
+    uint64_t cmds;
+    uint64_t result_mismatches;
+    uint64_t version_mismatches;
+    uint64_t late_ticks; // paced ticks that overran their slot
+
+    histogram apply_ns;
+    histogram commit_ns;
+    histogram tick_ns;
+
+    uint64_t next_slot; // paced: when the next tick may start
+    FILE *tick_log;
+} replay_state;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// === Input ===
+
+// Concatenates the inputs. Segment files are preallocated and the newest
+// one is zero-padded past its last record, so each file ends at its
+// first NUL.
+static char *load_inputs(const replay_config *cfg, size_t *len_out)
+{
+    size_t len = 0, cap = 1 << 16;
+    char *buf = Calloc(cap, 1);
+
+    for (int i = 0; i < cfg->num_inputs; i++)
+    {
+        bool is_stdin = strcmp(cfg->inputs[i], "-") == 0;
+        FILE *f = is_stdin ? stdin : fopen(cfg->inputs[i], "rb");
+        if (!f)
+        {
+            perror(cfg->inputs[i]);
+            free(buf);
+            return NULL;
+        }
+
+        size_t start = len;
+        size_t n;
+        do
+        {
+            if (cap - len < 4096)
+            {
+                cap *= 2;
+                buf = realloc(buf, cap);
+            }
+            n = fread(buf + len, 1, cap - len - 1, f);
+            len += n;
+        } while (n > 0);
+
+        char *nul = memchr(buf + start, '\0', len - start);
+        if (nul)
+            len = (size_t)(nul - buf);
+        if (!is_stdin)
+            fclose(f);
+    }
+
+    buf[len] = '\0';
+    *len_out = len;
+    return buf;
+}
+
+// Splits "user cmd result" into the command and its recorded result.
+// The result is the last one or two words, never part of the command.
+static bool split_edit(char *rest, char **user, char **command, char **result)
+{
+    char *sp = strchr(rest, ' ');
+    if (!sp)
+        return false;
+    *sp = '\0';
+    *user = rest;
+    *command = sp + 1;
+
+    char *last = strrchr(*command, ' ');
+    if (!last)
+        return false;
+    if (strcmp(last + 1, "SUCCESS") != 0)
+    {
+        // "Reject REASON" or "REJECT UNKNOWN_ERROR"
+        *last = '\0';
+        char *prev = strrchr(*command, ' ');
+        *last = ' ';
+        if (!prev || (strncmp(prev + 1, "Reject ", 7) != 0 && strncmp(prev + 1, "REJECT ", 7) != 0))
+            return false;
+        last = prev;
+    }
+    *last = '\0';
+    *result = last + 1;
+    return true;
+}
+
+static const char *result_name(int status)
+{
+    switch (status)
+    {
+    case SUCCESS:
+        return "SUCCESS";
+    case INVALID_CURSOR_POS:
+        return "Reject INVALID_POSITION";
+    case DELETED_POSITION:
+        return "Reject DELETED_POSITION";
+    case REJECT_UNAUTHORISED:
+        return "Reject UNAUTHORISED";
+    default:
+        return "REJECT UNKNOWN_ERROR";
+    }
+}
+
+// === Ticks ===
+
+static void wait_for_slot(const replay_config *cfg, replay_state *s)
+{
+    if (!cfg->pace_ms)
+        return;
+
+    uint64_t now = now_ns();
+    if (!s->next_slot)
+        s->next_slot = now;
+    if (now > s->next_slot + cfg->pace_ms * 1000000ull)
+        s->late_ticks++;
+    else
+    {
+        struct timespec ts = {(time_t)(s->next_slot / 1000000000ull), (long)(s->next_slot % 1000000000ull)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    s->next_slot += cfg->pace_ms * 1000000ull;
+}
+
+static void idle_ticks(const replay_config *cfg, replay_state *s, uint64_t n)
+{
+    s->ticks += n;
+    s->idle_ticks += n;
+    if (!cfg->pace_ms)
+        return;
+
+    // An idle run keeps its length in wall-clock time
+    if (!s->next_slot)
+        s->next_slot = now_ns();
+    s->next_slot += n * cfg->pace_ms * 1000000ull;
+}
+
+// Replays one record's EDIT lines, from `lines` to its END
+static void replay_tick(const replay_config *cfg, replay_state *s, uint64_t recorded_version,
+                        char **lines, size_t count)
+{
+    wait_for_slot(cfg, s);
+    uint64_t t0 = now_ns();
+    bool success = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        char *user, *command, *result;
+        if (!split_edit(lines[i] + 5, &user, &command, &result))
+        {
+            fprintf(stderr, "version %llu: unparsable EDIT line\n", (unsigned long long)recorded_version);
+            s->result_mismatches++;
+            continue;
+        }
+
+        // The role is not logged; a recorded UNAUTHORISED came from a reader
+        bool reader = strcmp(result, "Reject UNAUTHORISED") == 0;
+        cmd_ipc c = {.username = user, .role = reader ? "read" : "write", .raw_command = command};
+        int status = process_raw_command(s->doc, &c);
+        success |= status == SUCCESS;
+
+        if (strcmp(result_name(status), result) != 0)
+        {
+            if (s->result_mismatches++ < 10)
+                fprintf(stderr, "version %llu: %s %s recorded %s, replayed %s\n",
+                        (unsigned long long)recorded_version, user, command, result, result_name(status));
+        }
+    }
+
+    uint64_t t1 = now_ns();
+    markdown_increment_version(s->doc);
+    uint64_t t2 = now_ns();
+
+    if (success)
+        s->version++;
+    if (s->version != recorded_version)
+    {
+        s->version_mismatches++;
+        fprintf(stderr, "tick %llu: recorded version %llu, replayed %llu\n",
+                (unsigned long long)s->ticks, (unsigned long long)recorded_version,
+                (unsigned long long)s->version);
+        s->version = recorded_version;
+    }
+
+    s->ticks++;
+    s->cmds += count;
+    histogram_record(&s->apply_ns, t1 - t0);
+    histogram_record(&s->commit_ns, t2 - t1);
+    histogram_record(&s->tick_ns, t2 - t0);
+
+    if (s->tick_log)
+        fprintf(s->tick_log, "%llu,%zu,%llu,%llu,%llu,%llu,%llu,%zu\n",
+                (unsigned long long)recorded_version, count, (unsigned long long)(t1 - t0),
+                (unsigned long long)(t2 - t1), (unsigned long long)s->doc->commit_delete_ns,
+                (unsigned long long)s->doc->commit_insert_ns,
+                (unsigned long long)s->doc->commit_flatten_ns, s->doc->snapshot_len);
+}
+
+// Walks the records. Returns -1 on malformed input or, unless
+// keep_going, on the first version mismatch.
+static int replay_log(const replay_config *cfg, replay_state *s, char *data)
+{
+    size_t cap = 64, count = 0;
+    char **edits = Calloc(cap, sizeof(char *));
+    bool in_record = false;
+    uint64_t record_version = 0, idle = 0;
+    int rc = 0;
+
+    for (char *save, *line = strtok_r(data, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+    {
+        if (strncmp(line, "VERSION ", 8) == 0 && !in_record)
+        {
+            in_record = true;
+            record_version = strtoull(line + 8, NULL, 10);
+            count = 0;
+            idle = 0;
+
+            // Retention may have dropped the log's start
+            if (s->ticks == 0 && record_version != 1)
+            {
+                fprintf(stderr, "log starts at version %llu, not 1; it cannot be replayed from an empty document\n",
+                        (unsigned long long)record_version);
+                rc = -1;
+                break;
+            }
+        }
+        else if (in_record && strncmp(line, "EDIT ", 5) == 0)
+        {
+            if (count == cap)
+            {
+                cap *= 2;
+                edits = realloc(edits, cap * sizeof(char *));
+            }
+            edits[count++] = line;
+        }
+        else if (in_record && strncmp(line, "IDLE ", 5) == 0)
+        {
+            idle = strtoull(line + 5, NULL, 10);
+        }
+        else if (in_record && strcmp(line, "END") == 0)
+        {
+            in_record = false;
+            if (idle)
+                idle_ticks(cfg, s, idle);
+            else if (count == 0)
+                idle_ticks(cfg, s, 1); // an empty tick, logged without coalescing
+            else
+                replay_tick(cfg, s, record_version, edits, count);
+
+            if (s->version_mismatches && !cfg->keep_going)
+            {
+                rc = -1;
+                break;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unexpected line: %.60s\n", line);
+            rc = -1;
+            break;
+        }
+    }
+
+    if (rc == 0 && in_record)
+        fprintf(stderr, "log ends inside the record for version %llu; ignored\n",
+                (unsigned long long)record_version);
+    free(edits);
+    return rc;
+}
+
+// === Verification ===
+
+static int verify_document(const char *path, const document *doc)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    size_t cap = 1 << 16, len = 0, n;
+    char *saved = Calloc(cap, 1);
+    while ((n = fread(saved + len, 1, cap - len, f)) > 0)
+    {
+        len += n;
+        if (len == cap)
+        {
+            cap *= 2;
+            saved = realloc(saved, cap);
+        }
+    }
+    fclose(f);
+
+    const char *ours = doc->snapshot ? doc->snapshot : "";
+    size_t i = 0;
+    while (i < len && i < doc->snapshot_len && saved[i] == ours[i])
+        i++;
+
+    int rc = 0;
+    if (i == len && i == doc->snapshot_len)
+        printf("verify: matches %s (%zu bytes)\n", path, len);
+    else
+    {
+        printf("verify: differs from %s at byte %zu (saved %zu bytes, replayed %zu)\n", path, i, len,
+               doc->snapshot_len);
+        rc = -1;
+    }
+    free(saved);
+    return rc;
+}
+
+// === Main ===
+
+static void print_histogram(const char *name, const histogram *h)
+{
+    printf("%-7s p50=%.1f p90=%.1f p99=%.1f max=%.1f us\n", name,
+           (double)histogram_quantile(h, 0.5) / 1e3, (double)histogram_quantile(h, 0.9) / 1e3,
+           (double)histogram_quantile(h, 0.99) / 1e3, (double)h->max / 1e3);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <log>...\n"
+            "  <log>            LOG? output or .seg files in order; - reads stdin\n"
+            "  --expect=PATH    compare the final document with a saved doc.md\n"
+            "  --pace=MS        replay at the server's tick interval instead of flat out\n"
+            "  --ticks=PATH     per-tick CSV of timings\n"
+            "  --keep-going     continue past a version mismatch\n",
+            prog);
+}
+
+static int parse_args(replay_config *cfg, int argc, char *argv[])
+{
+    *cfg = (replay_config){0};
+    cfg->inputs = Calloc((size_t)argc, sizeof(char *));
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        if (strncmp(a, "--expect=", 9) == 0)
+            cfg->expect = a + 9;
+        else if (strncmp(a, "--ticks=", 8) == 0)
+            cfg->ticks = a + 8;
+        else if (strncmp(a, "--pace=", 7) == 0)
+            cfg->pace_ms = strtoul(a + 7, NULL, 10);
+        else if (strcmp(a, "--keep-going") == 0)
+            cfg->keep_going = true;
+        else if (a[0] == '-' && a[1] != '\0')
+            return -1;
+        else
+            cfg->inputs[cfg->num_inputs++] = a;
+    }
+    return cfg->num_inputs ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    replay_config cfg;
+    if (parse_args(&cfg, argc, argv) != 0)
+    {
+        usage(argv[0]);
+        free(cfg.inputs);
+        return 2;
+    }
+
+    size_t len;
+    char *data = load_inputs(&cfg, &len);
+    if (!data)
+        return 2;
+
+    replay_state *s = Calloc(1, sizeof(replay_state));
+    s->doc = markdown_init();
+    s->version = 1;
+    if (cfg.ticks)
+    {
+        s->tick_log = fopen(cfg.ticks, "w");
+        if (!s->tick_log)
+        {
+            perror(cfg.ticks);
+            return 2;
+        }
+        fprintf(s->tick_log, "version,cmds,apply_ns,commit_ns,delete_ns,insert_ns,flatten_ns,doc_bytes\n");
+    }
+
+    uint64_t started = now_ns();
+    int rc = replay_log(&cfg, s, data);
+    double elapsed = (double)(now_ns() - started) / 1e9;
+
+    printf("ticks=%llu (idle %llu) cmds=%llu version=%llu doc_bytes=%zu in %.3fs\n",
+           (unsigned long long)s->ticks, (unsigned long long)s->idle_ticks,
+           (unsigned long long)s->cmds, (unsigned long long)s->version, s->doc->snapshot_len, elapsed);
+    printf("mismatches: results=%llu versions=%llu", (unsigned long long)s->result_mismatches,
+           (unsigned long long)s->version_mismatches);
+    if (cfg.pace_ms)
+        printf(" late_ticks=%llu", (unsigned long long)s->late_ticks);
+    printf("\n");
+    print_histogram("apply", &s->apply_ns);
+    print_histogram("commit", &s->commit_ns);
+    print_histogram("tick", &s->tick_ns);
+
+    if (rc == 0 && cfg.expect && verify_document(cfg.expect, s->doc) != 0)
+        rc = -1;
+    if (s->result_mismatches || s->version_mismatches)
+        rc = -1;
+
+    if (s->tick_log)
+        fclose(s->tick_log);
+    markdown_free(s->doc);
+    free(s);
+    free(data);
+    free(cfg.inputs);
+    return rc == 0 ? 0 : 1;
+}
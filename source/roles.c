@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "roles.h"
+#include "hash_map.h"
+#include "rcu.h"
+
+static char *roles_path = NULL;
+static _Atomic(hash_map *) roles_table = NULL;
+static rcu_domain roles_rcu = RCU_DOMAIN_INIT;
+
+// Identity of the file the current table was built from
+static struct stat roles_stat;
+static int roles_stat_valid = 0;
+
+static hash_map *load_roles(const char *path)
+{
+    hash_map *map = hash_map_create(64);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return map;
+
+    char *line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, f) != -1)
+    {
+        char *saveptr = NULL;
+        char *user = strtok_r(line, " \t\r\n", &saveptr);
+        char *role = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (!user || !role)
+            continue;
+        if (strcmp(role, "read") != 0 && strcmp(role, "write") != 0)
+            continue;
+
+        // First entry for a user wins, as with the old linear scan
+        if (!hash_map_get(map, user))
+            hash_map_put(map, user, strdup(role));
+    }
+
+    free(line);
+    fclose(f);
+    return map;
+}
+
+static int same_file(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+void roles_init(const char *path)
+{
+    roles_path = strdup(path);
+    roles_stat_valid = stat(roles_path, &roles_stat) == 0;
+    atomic_store(&roles_table, load_roles(roles_path));
+}
+
+void roles_maybe_reload(void)
+{
+    struct stat st;
+    int valid = stat(roles_path, &st) == 0;
+
+    if (valid == roles_stat_valid && (!valid || same_file(&st, &roles_stat)))
+        return;
+
+    roles_stat = st;
+    roles_stat_valid = valid;
+
+    hash_map *old = atomic_exchange(&roles_table, load_roles(roles_path));
+    rcu_synchronize(&roles_rcu);
+    hash_map_free(old, free);
+}
+
+char *roles_lookup(const char *username)
+{
+    unsigned slot = rcu_read_lock(&roles_rcu);
+    hash_map *map = atomic_load(&roles_table);
+    const char *role = map ? hash_map_get(map, username) : NULL;
+    char *copy = role ? strdup(role) : NULL;
+    rcu_read_unlock(&roles_rcu, slot);
+    return copy;
+}
+
+void roles_free(void)
+{
+    hash_map_free(atomic_exchange(&roles_table, NULL), free);
+    free(roles_path);
+    roles_path = NULL;
+}
@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "segment_log.h"
+#include "ipc_helpers.h"
+#include "memory.h"
+
+static void segment_path(const segment_log *log, uint64_t id, char *out, size_t cap)
+{
+    snprintf(out, cap, "%s/%08llu.seg", log->dir, (unsigned long long)id);
+}
+
+// Only names segment_path() produces: eight or more digits, then ".seg"
+static bool is_segment_name(const char *name)
+{
+    size_t digits = strspn(name, "0123456789");
+    return digits >= 8 && strcmp(name + digits, ".seg") == 0;
+}
+
+static void remove_stale_segments(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    struct dirent *e;
+    char path[4096];
+    while ((e = readdir(d)) != NULL)
+    {
+        if (is_segment_name(e->d_name))
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+// Full segments keep neither mapping nor fd; spans reopen them by path,
+// so a long log does not hold one descriptor per segment
+static void seal_segment(const segment_log *log, log_segment *seg)
+{
+    if (seg->base)
+    {
+        munmap(seg->base, log->segment_size);
+        seg->base = NULL;
+    }
+    if (seg->fd >= 0)
+    {
+        close(seg->fd);
+        seg->fd = -1;
+    }
+}
+
+// The file goes now; spans that opened it keep reading their own fd
+static void drop_segment(segment_log *log, log_segment *seg)
+{
+    char path[4096];
+    segment_path(log, seg->id, path, sizeof(path));
+
+    seal_segment(log, seg);
+    unlink(path);
+    free(seg);
+}
+
+// Creates the next segment's file and mapping; push_segment() links it
+static log_segment *new_segment(segment_log *log)
+{
+    char path[4096];
+    log_segment *seg = Calloc(1, sizeof(log_segment));
+    seg->id = log->next_id++;
+    seg->first_record = log->segment_size;
+    segment_path(log, seg->id, path, sizeof(path));
+
+    seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (seg->fd < 0)
+    {
+        free(seg);
+        return NULL;
+    }
+
+    if (ftruncate(seg->fd, (off_t)log->segment_size) != 0)
+        goto fail;
+
+    seg->base = mmap(NULL, log->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if (seg->base == MAP_FAILED)
+        goto fail;
+    return seg;
+
+fail:
+    close(seg->fd);
+    unlink(path);
+    free(seg);
+    return NULL;
+}
+
+segment_log *segment_log_open(const char *dir, size_t segment_size, size_t retain)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return NULL;
+
+    // Versions restart with the server, so old segments are meaningless
+    remove_stale_segments(dir);
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (segment_size < (size_t)page)
+        segment_size = (size_t)page;
+
+    segment_log *log = Calloc(1, sizeof(segment_log));
+    log->dir = strdup(dir);
+    log->segment_size = segment_size;
+    log->retain = retain;
+    log->segments = create_array(8);
+    return log;
+}
+
+void segment_log_close(segment_log *log)
+{
+    if (!log)
+        return;
+
+    for (size_t i = 0; i < log->segments->size; i++)
+    {
+        log_segment *seg = get_from(log->segments, i);
+        // Leave a file that holds exactly the bytes written
+        if (seg->fd >= 0 && ftruncate(seg->fd, (off_t)seg->len) != 0)
+            perror("segment_log truncate");
+        seal_segment(log, seg);
+        free(seg);
+    }
+
+    log->segments->size = 0;
+    free_array(log->segments);
+    free(log->dir);
+    free(log);
+}
+
+static void push_segment(segment_log *log, log_segment *seg)
+{
+    append_to(log->segments, seg);
+
+    // Retention drops whole segments from the front
+    if (log->retain && log->segments->size > log->retain)
+    {
+        log_segment *old = remove_at(log->segments, 0);
+        log->base_offset += log->segment_size;
+        drop_segment(log, old);
+    }
+}
+
+int segment_log_append(segment_log *log, const char *data, size_t len)
+{
+    if (len == 0)
+        return 0;
+
+    log_segment *seg = log->segments->size
+                           ? get_from(log->segments, log->segments->size - 1)
+                           : NULL;
+    size_t room = seg ? log->segment_size - seg->len : 0;
+
+    // Every segment the record spills into exists before any of it is
+    // copied, so a failure cannot leave half a record in the log
+    size_t need = len > room ? (len - room + log->segment_size - 1) / log->segment_size : 0;
+    log_segment **fresh = need ? Calloc(need, sizeof(log_segment *)) : NULL;
+    uint64_t next_id = log->next_id;
+    for (size_t i = 0; i < need; i++)
+    {
+        fresh[i] = new_segment(log);
+        if (!fresh[i])
+        {
+            while (i-- > 0)
+                drop_segment(log, fresh[i]);
+            log->next_id = next_id;
+            free(fresh);
+            return -1;
+        }
+    }
+
+    bool record_start = true;
+    for (size_t i = 0; len > 0;)
+    {
+        if (!seg || seg->len == log->segment_size)
+        {
+            if (seg)
+                seal_segment(log, seg);
+            seg = fresh[i++];
+            push_segment(log, seg);
+        }
+
+        room = log->segment_size - seg->len;
+        size_t n = len < room ? len : room;
+
+        if (record_start && seg->first_record == log->segment_size)
+            seg->first_record = seg->len;
+        record_start = false;
+
+        memcpy(seg->base + seg->len, data, n);
+        seg->len += n;
+        log->total_len += n;
+        data += n;
+        len -= n;
+    }
+
+    free(fresh);
+    return 0;
+}
+
+void segment_log_pin(segment_log *log, uint64_t from, uint64_t to, log_span *out)
+{
+    // Retention may have cut a record in half; resume at the next whole one
+    if (from < log->base_offset)
+    {
+        from = log->total_len;
+        for (size_t i = 0; i < log->segments->size; i++)
+        {
+            log_segment *seg = get_from(log->segments, i);
+            if (seg->first_record < log->segment_size)
+            {
+                from = log->base_offset + i * log->segment_size + seg->first_record;
+                break;
+            }
+        }
+    }
+    if (to > log->total_len)
+        to = log->total_len;
+    if (from > to)
+        from = to;
+
+    *out = (log_span){.from = from, .to = to, .segment_size = log->segment_size};
+    if (from == to)
+        return;
+
+    size_t first = (size_t)((from - log->base_offset) / log->segment_size);
+    size_t last = (size_t)((to - 1 - log->base_offset) / log->segment_size);
+    out->start = log->base_offset + (uint64_t)first * log->segment_size;
+    out->fds = Calloc(last - first + 1, sizeof(int));
+    for (size_t i = first; i <= last; i++)
+    {
+        char path[4096];
+        log_segment *seg = get_from(log->segments, i);
+        segment_path(log, seg->id, path, sizeof(path));
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            // Serve what could be opened (out of fds, most likely)
+            uint64_t seg_start = log->base_offset + (uint64_t)i * log->segment_size;
+            out->to = seg_start > from ? seg_start : from;
+            break;
+        }
+        out->fds[out->count++] = fd;
+    }
+}
+
+int log_span_stream(const log_span *span, int out_fd, uint64_t from, uint64_t to)
+{
+    if (from < span->from)
+        from = span->from;
+    if (to > span->to)
+        to = span->to;
+
+    // Bytes below span->to were written before pinning, so the active
+    // segment can be read while the tick keeps appending past them
+    while (from < to)
+    {
+        size_t idx = (size_t)((from - span->start) / span->segment_size);
+        uint64_t seg_start = span->start + (uint64_t)idx * span->segment_size;
+        size_t local = (size_t)(from - seg_start);
+        size_t n = span->segment_size - local;
+        if (n > to - from)
+            n = (size_t)(to - from);
+
+        if (send_file_range(out_fd, span->fds[idx], (off_t)local, n) != 0)
+            return -1;
+        from += n;
+    }
+
+    return 0;
+}
+
+void log_span_release(log_span *span)
+{
+    for (size_t i = 0; i < span->count; i++)
+        close(span->fds[i]);
+    free(span->fds);
+    span->fds = NULL;
+    span->count = 0;
+}
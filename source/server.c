@@ -12,50 +12,54 @@
 #include <sys/time.h>
 
 #include "array_list.h"
+#include "client_registry.h"
+#include "cmd_queue.h"
+#include "doc_registry.h"
 #include "document.h"
 #include "markdown.h"
 #include "ipc_helpers.h"
+#include "roles.h"
+#include "server_config.h"
+#include "stats.h"
+#include "tick_scheduler.h"
+#include "trace.h"
+#include "work_pool.h"
 
 #define MAX_FIFO_NAME 64
 
-document *global_doc = NULL;
-pthread_mutex_t doc_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-array_list *connected_clients;
-pthread_mutex_t client_list_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-array_list *global_cmd_list;
-pthread_mutex_t cmd_list_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-char *server_log = NULL;
-size_t server_log_len = 0;
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-char *current_log_entry = NULL;
-size_t current_log_len = 0;
-size_t current_log_cap = 0;
-
-uint64_t global_version = 1;
-unsigned long time_interval_ms;
+server_config config;
+tick_scheduler scheduler;
 
 void handle_sig(int sig, siginfo_t *info, void *context);
 void *client_thread(void *arg);
+void doc_tick(void *arg);
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (parse_server_config(&config, argc, argv) != 0)
+    {
+        print_server_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (tick_scheduler_init(&scheduler, &config) != 0)
     {
-        fprintf(stderr, "Usage: %s <TIME_INTERVAL_MS>\n", argv[0]);
+        perror("tick scheduler");
         exit(EXIT_FAILURE);
     }
 
-    time_interval_ms = strtoul(argv[1], NULL, 10);
     printf("Server PID: %d\n", getpid());
 
-    global_doc = markdown_init();
-    connected_clients = create_array(8);
-    global_cmd_list = create_array(16);
-    server_log = Calloc(1, 1);
+    if (doc_registry_init() != 0)
+    {
+        perror(config.log_dir);
+        exit(EXIT_FAILURE);
+    }
+    roles_init("roles.txt");
+
+    TRACE_THREAD_NAME("main");
+    work_pool *pool = work_pool_create(config.workers);
+    array_list *docs = create_array(16);
 
     struct sigaction sa = {0};
     sa.sa_flags = SA_SIGINFO;
@@ -65,99 +69,184 @@ int main(int argc, char *argv[])
 
     while (1)
     {
-        sleep_ms(time_interval_ms);
-        handle_server_stdin();
+        unsigned wake = tick_scheduler_wait(&scheduler);
+
+        if ((wake & WAKE_INPUT) && handle_server_stdin() != 0)
+            tick_scheduler_ignore_input(&scheduler);
 
-        pthread_mutex_lock(&cmd_list_mutex);
-        size_t cmd_count = global_cmd_list->size;
-        pthread_mutex_unlock(&cmd_list_mutex);
+        if (!(wake & WAKE_TICK))
+            continue;
 
-        bool success_occured = false;
-        uint64_t broadcast_version = global_version;
+        roles_maybe_reload();
 
-        if (cmd_count != 0)
+        // Each document ticks independently; a lone document runs here
+        // rather than paying for a hand-off to the pool
+        doc_registry_list(docs);
+        if (docs->size == 1)
         {
-            reset_log_buffer();
-            
-            pthread_mutex_lock(&doc_mutex);
-            pthread_mutex_lock(&cmd_list_mutex);
-            for (size_t i = 0; i < global_cmd_list->size; i++)
-            {
-                cmd_ipc *c = (cmd_ipc *)get_from(global_cmd_list, i);
-                int status = process_raw_command(global_doc, c);
-
-                if (status == SUCCESS)
-                    success_occured = true;
-
-                const char *result_str = NULL;
-
-                switch (status)
-                {
-                case SUCCESS:
-                    result_str = "SUCCESS";
-                    break;
-                case INVALID_CURSOR_POS:
-                    result_str = "Reject INVALID_POSITION";
-                    break;
-                case DELETED_POSITION:
-                    result_str = "Reject DELETED_POSITION";
-                    break;
-                case REJECT_UNAUTHORISED:
-                    result_str = "Reject UNAUTHORISED";
-                    break;
-                default:
-                    result_str = "REJECT UNKNOWN_ERROR";
-                    break;
-                }
-
-                int n = snprintf(NULL, 0, "EDIT %s %s %s\n", c->username, c->raw_command, result_str);
-                char *line = Calloc(n + 1, 1);
-                snprintf(line, n + 1, "EDIT %s %s %s\n", c->username, c->raw_command, result_str);
-                append_to_log_buffer(line, n);
-                free(line);
-            }
+            doc_tick(get_from(docs, 0));
+        }
+        else
+        {
+            for (size_t i = 0; i < docs->size; i++)
+                work_pool_submit(pool, doc_tick, get_from(docs, i));
+            work_pool_wait(pool);
+        }
 
-            markdown_increment_version(global_doc);
-            if (success_occured) {
-                global_version++;
-                broadcast_version = global_version;
-            }
+        size_t cmd_count = 0;
+        size_t cmd_bytes = 0;
+        for (size_t i = 0; i < docs->size; i++)
+        {
+            hosted_doc *d = get_from(docs, i);
+            cmd_count += d->tick_cmds;
+            cmd_bytes += d->tick_bytes;
+        }
+        docs->size = 0;
 
-            for (size_t i = 0; i < global_cmd_list->size; i++)
-            {
-                free_cmd_ipc(get_from(global_cmd_list, i));
-            }
-            global_cmd_list = clear_array(global_cmd_list);
+        tick_scheduler_note_commit(&scheduler, cmd_count, cmd_bytes);
+        stats_maybe_dump();
+    }
 
-            pthread_mutex_unlock(&cmd_list_mutex);
-            pthread_mutex_unlock(&doc_mutex);
+    return 0;
+}
+
+// Commits one document's batch and broadcasts the result
+void doc_tick(void *arg)
+{
+    hosted_doc *d = arg;
+    doc_stats *stats = d->stats;
+    TRACE_BEGIN("doc_tick");
+    uint64_t started = stats_now_ns();
 
-            char version_line[64];
-            int version_len = snprintf(version_line, sizeof(version_line),
-                                       "VERSION %llu\n", (unsigned long long)broadcast_version);
+    size_t cmd_count = collect_cmd_batch(d);
+    size_t cmd_bytes = 0;
 
-            memmove(current_log_entry + version_len, current_log_entry, current_log_len);
-            memcpy(current_log_entry, version_line, version_len);
-            current_log_len += version_len;
+    bool success_occured = false;
+    uint64_t broadcast_version = d->version;
 
-            append_to_log_buffer("END\n", 4);
+    d->tick_cmds = cmd_count;
+    d->tick_bytes = 0;
 
-            append_to_server_log();
-            
+    if (cmd_count != 0)
+    {
+        flush_idle_run(d);
+        reset_log_buffer(d);
+
+        // Splices are only worth recording while someone applies them
+        bool record_splices = atomic_load(&d->delta_clients) > 0;
+        if (record_splices)
+            d->doc->splices = d->doc->splices ? clear_array(d->doc->splices) : create_array(16);
+        else if (d->doc->splices)
+        {
+            free_array(d->doc->splices);
+            d->doc->splices = NULL;
         }
-        else
+
+        for (size_t i = 0; i < d->cmd_list->size; i++)
+        {
+            cmd_ipc *c = (cmd_ipc *)get_from(d->cmd_list, i);
+            TRACE_BEGIN("process_raw_command");
+            int status = process_raw_command(d->doc, c);
+            TRACE_END("process_raw_command");
+            cmd_bytes += strlen(c->raw_command);
+
+            if (status == SUCCESS)
+                success_occured = true;
+
+            const char *result_str = NULL;
+
+            switch (status)
+            {
+            case SUCCESS:
+                result_str = "SUCCESS";
+                break;
+            case INVALID_CURSOR_POS:
+                result_str = "Reject INVALID_POSITION";
+                break;
+            case DELETED_POSITION:
+                result_str = "Reject DELETED_POSITION";
+                break;
+            case REJECT_UNAUTHORISED:
+                result_str = "Reject UNAUTHORISED";
+                break;
+            default:
+                result_str = "REJECT UNKNOWN_ERROR";
+                break;
+            }
+
+            int n = snprintf(NULL, 0, "EDIT %s %s %s\n", c->username, c->raw_command, result_str);
+            char *line = Calloc(n + 1, 1);
+            snprintf(line, n + 1, "EDIT %s %s %s\n", c->username, c->raw_command, result_str);
+            append_to_log_buffer(d, line, n);
+            free(line);
+        }
+
+        uint64_t applied = stats_now_ns();
+        histogram_record(&stats->phase_ns[PHASE_APPLY], applied - started);
+
+        // The published view owns the old buffers; keep the commit from freeing them
+        d->doc->snapshot = NULL;
+        d->doc->line_marks = NULL;
+        markdown_increment_version(d->doc);
+        histogram_record(&stats->phase_ns[PHASE_DELETES], d->doc->commit_delete_ns);
+        histogram_record(&stats->phase_ns[PHASE_INSERTS], d->doc->commit_insert_ns);
+        histogram_record(&stats->phase_ns[PHASE_FLATTEN], d->doc->commit_flatten_ns);
+        stats->commits++;
+        stats->cmds += cmd_count;
+        stats->doc_bytes = d->doc->snapshot_len;
+        stats->chunks = d->doc->num_chunks;
+        if (success_occured) {
+            d->version++;
+            broadcast_version = d->version;
+            d->checksum = d->doc->snapshot_hash;
+        }
+        hosted_doc_publish(d);
+
+        for (size_t i = 0; i < d->cmd_list->size; i++)
         {
+            free_cmd_ipc(get_from(d->cmd_list, i));
+        }
+        d->cmd_list = clear_array(d->cmd_list);
 
-            reset_log_buffer();
-            current_log_len = snprintf(current_log_entry, current_log_cap,
-                                       "VERSION %llu\nEND\n", (unsigned long long)global_version);
-            append_to_server_log(); 
+        set_log_version(d, broadcast_version);
+        append_to_log_buffer(d, "END\n", 4);
+        if (record_splices)
+            build_delta_entry(d);
+
+        uint64_t logged = stats_now_ns();
+        append_to_server_log(d);
+        histogram_record(&stats->phase_ns[PHASE_LOG], stats_now_ns() - logged);
+        d->tick_bytes = cmd_bytes;
+    }
+    else if (config.heartbeat_ms == 0)
+    {
+        reset_log_buffer(d);
+        set_log_version(d, d->version);
+        append_to_log_buffer(d, "END\n", 4);
+        append_to_server_log(d);
+    }
+    else
+    {
+        // Idle: logged as a run, broadcast only as a periodic keepalive
+        note_idle_tick(d);
+        if (!heartbeat_due(d, config.heartbeat_ms, config.interval_ms))
+        {
+            TRACE_END("doc_tick");
+            return;
         }
 
-        send_broadcast_to_all_clients();
+        reset_log_buffer(d);
+        set_log_version(d, d->version);
+        append_to_log_buffer(d, "END\n", 4);
     }
 
-    return 0;
+    uint64_t broadcasting = stats_now_ns();
+    send_broadcast_to_all_clients(d);
+    uint64_t done = stats_now_ns();
+    histogram_record(&stats->phase_ns[PHASE_BROADCAST], done - broadcasting);
+    if (cmd_count != 0)
+        histogram_record(&stats->phase_ns[PHASE_TICK], done - started);
+    TRACE_END("doc_tick");
 }
 
 void handle_sig(int sig, siginfo_t *info, void *context)
@@ -186,19 +275,25 @@ void *client_thread(void *arg)
     mkfifo(fifo_c2s, 0666);
     mkfifo(fifo_s2c, 0666);
 
-    
-    int fd_c2s = open(fifo_c2s, O_RDONLY);
-    int fd_s2c = open(fifo_s2c, O_WRONLY);
 
     sigqueue(client_pid, SIGRTMIN + 1, (union sigval){.sival_int = 0});
+
+    int fd_c2s = open(fifo_c2s, O_RDONLY);
+    int fd_s2c = open(fifo_s2c, O_WRONLY);
     
     char *username = NULL;
     char *role = NULL;
-    get_user_role(&username, &role, fd_c2s);
+    handshake_opts opts;
+    get_user_role(&username, &role, &opts, fd_c2s);
 
-    if (!username || !role)
+    hosted_doc *d = NULL;
+    if (username && role)
+        d = doc_registry_open(opts.doc);
+    free(opts.doc);
+
+    if (!username || !role || !d)
     {
-        dprintf(fd_s2c, "Reject UNAUTHORISED\n");
+        dprintf(fd_s2c, (username && role) ? "Reject INVALID_DOCUMENT\n" : "Reject UNAUTHORISED\n");
         sleep(1);
         close(fd_c2s);
         close(fd_s2c);
@@ -209,26 +304,27 @@ void *client_thread(void *arg)
         return NULL;
     }
 
-    dprintf(fd_s2c, "%s\n", role);
-    pthread_mutex_lock(&doc_mutex);
-    dprintf(fd_s2c, "%llu\n", (unsigned long long)global_version);
-    dprintf(fd_s2c, "%zu\n", global_doc->snapshot_len);
-    write(fd_s2c, global_doc->snapshot, global_doc->snapshot_len);
-    pthread_mutex_unlock(&doc_mutex);
-
     client_info *cinfo = Calloc(1, sizeof(client_info));
     cinfo->pid = client_pid;
     cinfo->fd_s2c = fd_s2c;
     cinfo->username = username;
     cinfo->permission = role;
+    cinfo->deltas = opts.deltas;
+    pthread_mutex_init(&cinfo->lock, NULL);
+    if (cinfo->deltas)
+        atomic_fetch_add(&d->delta_clients, 1);
 
-    pthread_mutex_lock(&client_list_mutex);
-    append_to(connected_clients, cinfo);
-    pthread_mutex_unlock(&client_list_mutex);
+    cmd_queue *queue = cmd_queue_create();
+    register_cmd_queue(d, queue);
 
+    send_bootstrap(d, cinfo, fd_c2s, &opts);
+
+    TRACE_THREAD_NAME("client");
     while (1)
     {
+        TRACE_BEGIN("client_read");
         char *line = read_line_dynamic(fd_c2s);
+        TRACE_END("client_read");
         if (!line)
             break;
 
@@ -242,21 +338,26 @@ void *client_thread(void *arg)
         cmd->username = strdup(cinfo->username);
         cmd->role = strdup(cinfo->permission);
         cmd->raw_command = line;
-        gettimeofday(&cmd->timestamp, NULL);
-        
 
-        insert_sorted_cmd(cmd);
+        enqueue_cmd(queue, cmd);
     }
 
-    close(fd_c2s);
-    close(fd_s2c);
+    // The tick frees the queue once it has drained it
+    cmd_queue_close(queue);
+
+    // Returns once no broadcast can still write to fd_s2c
+    client_registry_remove(d->clients, cinfo->handle);
+    if (cinfo->deltas)
+        atomic_fetch_sub(&d->delta_clients, 1);
+
+    // Unlinked before closing: once the client sees EOF it may reconnect
+    // under the same pid, and must not lose its new FIFOs to us
     unlink(fifo_c2s);
     unlink(fifo_s2c);
+    close(fd_c2s);
+    close(fd_s2c);
 
-    pthread_mutex_lock(&client_list_mutex);
-    remove_from(connected_clients, cinfo);
-    pthread_mutex_unlock(&client_list_mutex);
-
+    pthread_mutex_destroy(&cinfo->lock);
     free(cinfo->username);
     free(cinfo->permission);
     free(cinfo);
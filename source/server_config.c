@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server_config.h"
+
+static int parse_size(const char *value, size_t *out)
+{
+    if (!value || !*value)
+        return -1;
+
+    char *end = NULL;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (*end != '\0')
+        return -1;
+
+    *out = (size_t)v;
+    return 0;
+}
+
+static int opt_is(const char *arg, size_t name_len, const char *name)
+{
+    return strlen(name) == name_len && strncmp(arg, name, name_len) == 0;
+}
+
+int parse_server_config(server_config *cfg, int argc, char *argv[])
+{
+    if (argc < 2)
+        return -1;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->early_cmds = 64;
+    cfg->early_bytes = 64 * 1024;
+    cfg->log_dir = "server_log.d";
+    cfg->log_segment_size = 4 * 1024 * 1024;
+    cfg->stats_file = "stats.jsonl";
+
+    char *end = NULL;
+    cfg->interval_ms = strtoul(argv[1], &end, 10);
+    if (*end != '\0')
+        return -1;
+
+    for (int i = 2; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = strchr(arg, '=');
+        size_t name_len = value ? (size_t)(value - arg) : strlen(arg);
+        if (value)
+            value++;
+
+        if (opt_is(arg, name_len, "--adaptive") && !value)
+            cfg->adaptive = true;
+        else if (opt_is(arg, name_len, "--early-cmds"))
+        {
+            if (parse_size(value, &cfg->early_cmds) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--early-bytes"))
+        {
+            if (parse_size(value, &cfg->early_bytes) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--heartbeat"))
+        {
+            size_t ms;
+            if (parse_size(value, &ms) != 0)
+                return -1;
+            cfg->heartbeat_ms = (unsigned long)ms;
+        }
+        else if (opt_is(arg, name_len, "--log-dir"))
+        {
+            if (!value || !*value)
+                return -1;
+            cfg->log_dir = value;
+        }
+        else if (opt_is(arg, name_len, "--log-segment-size"))
+        {
+            if (parse_size(value, &cfg->log_segment_size) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--log-retain"))
+        {
+            if (parse_size(value, &cfg->log_retain) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--log-user-index") && !value)
+            cfg->log_user_index = true;
+        else if (opt_is(arg, name_len, "--max-docs"))
+        {
+            if (parse_size(value, &cfg->max_docs) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--workers"))
+        {
+            if (parse_size(value, &cfg->workers) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--rate"))
+        {
+            if (parse_size(value, &cfg->rate) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--rate-read"))
+        {
+            if (parse_size(value, &cfg->rate_read) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--burst"))
+        {
+            if (parse_size(value, &cfg->burst) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--tick-cmds"))
+        {
+            if (parse_size(value, &cfg->tick_cmds) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--tick-bytes"))
+        {
+            if (parse_size(value, &cfg->tick_bytes) != 0)
+                return -1;
+        }
+        else if (opt_is(arg, name_len, "--stats-interval"))
+        {
+            size_t ms;
+            if (parse_size(value, &ms) != 0)
+                return -1;
+            cfg->stats_interval_ms = (unsigned long)ms;
+        }
+        else if (opt_is(arg, name_len, "--stats-file"))
+        {
+            if (!value || !*value)
+                return -1;
+            cfg->stats_file = value;
+        }
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+void print_server_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s <TIME_INTERVAL_MS> [options]\n"
+            "  --adaptive          commit early under load, sleep while idle\n"
+            "  --early-cmds=N      queued commands that trigger an early commit (64)\n"
+            "  --early-bytes=N     queued command bytes that trigger an early commit (65536)\n"
+            "  --heartbeat=MS      coalesce idle ticks into a keepalive every MS\n"
+            "  --log-dir=DIR       directory for server log segments (server_log.d)\n"
+            "  --log-segment-size=N  bytes per log segment (4194304)\n"
+            "  --log-retain=N      segments to keep, 0 keeps all (0)\n"
+            "  --log-user-index    index log records by user for LOG? user=<name>\n"
+            "  --max-docs=N        documents hosted at once, 0 = unlimited (0)\n"
+            "  --workers=N         threads running document ticks, 0 = one per CPU (0)\n"
+            "  --rate=N            commands per second per user, 0 = unlimited (0)\n"
+            "  --rate-read=N       rate for read-only users, 0 = same as --rate (0)\n"
+            "  --burst=N           commands a user may send at once (the rate)\n"
+            "  --tick-cmds=N       commands applied per tick, the rest wait (0)\n"
+            "  --tick-bytes=N      command bytes applied per tick, the rest wait (0)\n"
+            "  --stats-interval=MS append STATS? JSON to the stats file every MS, 0 = off (0)\n"
+            "  --stats-file=PATH   file for periodic stats (stats.jsonl)\n",
+            prog);
+}
@@ -0,0 +1,63 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "snapshot_share.h"
+#include "ipc_helpers.h"
+#include "memory.h"
+
+static shared_snapshot *build_snapshot(const char *data, size_t len, uint64_t version)
+{
+    int fd = memfd_create("snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return NULL;
+
+    // Keep the terminator so a mapping can be parsed as a C string
+    if (write_all(fd, data, len + 1) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+    shared_snapshot *snap = Calloc(1, sizeof(shared_snapshot));
+    atomic_init(&snap->refs, 1); // the cache's reference
+    snap->version = version;
+    snap->fd = fd;
+    snap->len = len;
+    return snap;
+}
+
+shared_snapshot *shared_snapshot_acquire(shared_snapshot **cache, const char *data,
+                                         size_t len, uint64_t version)
+{
+    if (!*cache || (*cache)->version != version)
+    {
+        shared_snapshot *fresh = build_snapshot(data, len, version);
+        if (!fresh)
+            return NULL;
+        if (*cache)
+            shared_snapshot_release(*cache);
+        *cache = fresh;
+    }
+
+    atomic_fetch_add(&(*cache)->refs, 1);
+    return *cache;
+}
+
+void shared_snapshot_release(shared_snapshot *snap)
+{
+    if (snap && atomic_fetch_sub(&snap->refs, 1) == 1)
+    {
+        close(snap->fd);
+        free(snap);
+    }
+}
+
+void shared_snapshot_reset(shared_snapshot **cache)
+{
+    shared_snapshot_release(*cache);
+    *cache = NULL;
+}
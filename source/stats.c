@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "stats.h"
+#include "client_registry.h"
+#include "doc_registry.h"
+#include "memory.h"
+#include "server_config.h"
+#include "throttle.h"
+#include "tick_scheduler.h"
+
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// === JSON ===
+
+static const char *phase_names[PHASE_COUNT] = {
+    "tick", "apply", "deletes", "inserts", "flatten", "log", "broadcast",
+};
+
+static void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_histogram(FILE *out, const histogram *h)
+{
+    fprintf(out,
+            "{\"count\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+            "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}",
+            (unsigned long long)h->total, h->total ? (double)h->sum / (double)h->total / 1e3 : 0.0,
+            (double)histogram_quantile(h, 0.5) / 1e3, (double)histogram_quantile(h, 0.9) / 1e3,
+            (double)histogram_quantile(h, 0.99) / 1e3, (double)histogram_quantile(h, 0.999) / 1e3,
+            (double)h->max / 1e3);
+}
+
+typedef struct lag_writer
+{
+    FILE *out;
+    bool first;
+} lag_writer;
+
+// Bytes written to the client's pipe that it has not read yet
+static void write_client_lag(client_info *c, void *arg)
+{
+    lag_writer *w = arg;
+    int unread = 0;
+    if (ioctl(c->fd_s2c, FIONREAD, &unread) != 0)
+        unread = -1;
+
+    fprintf(w->out, "%s{\"user\":", w->first ? "" : ",");
+    write_json_string(w->out, c->username);
+    fprintf(w->out, ",\"pid\":%d,\"lag_bytes\":%d}", (int)c->pid, unread);
+    w->first = false;
+}
+
+static void write_doc(FILE *out, hosted_doc *d)
+{
+    const doc_stats *s = d->stats;
+    doc_view *v = doc_view_acquire(d);
+
+    fputs("{\"name\":", out);
+    write_json_string(out, d->name);
+    fprintf(out,
+            ",\"version\":%llu,\"doc_bytes\":%zu,\"chunks\":%zu,\"clients\":%zu,"
+            "\"carried_cmds\":%zu,\"commits\":%llu,\"cmds\":%llu,\"broadcasts\":%llu,"
+            "\"bytes_broadcast\":%llu,\"log_errors\":%llu,\"phases\":{",
+            (unsigned long long)v->version, v->len, s->chunks, client_registry_count(d->clients),
+            d->cmd_carry->size, (unsigned long long)s->commits, (unsigned long long)s->cmds,
+            (unsigned long long)s->broadcasts, (unsigned long long)s->bytes_broadcast,
+            (unsigned long long)s->log_errors);
+    doc_view_release(v);
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        fprintf(out, "%s\"%s\":", p ? "," : "", phase_names[p]);
+        write_histogram(out, &s->phase_ns[p]);
+    }
+
+    fputs("},\"client_lag\":[", out);
+    lag_writer w = {out, true};
+    client_registry_for_each(d->clients, write_client_lag, &w);
+    fputs("]}", out);
+}
+
+void stats_write_json(FILE *out)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    fprintf(out, "{\"time_ms\":%llu,\"pending_cmds\":%zu,\"pending_bytes\":%zu,\"allocs\":%zu,\"docs\":[",
+            (unsigned long long)now.tv_sec * 1000 + (unsigned long long)now.tv_nsec / 1000000,
+            atomic_load(&scheduler.pending_cmds), atomic_load(&scheduler.pending_bytes),
+            calloc_count());
+
+    array_list *docs = create_array(16);
+    doc_registry_list(docs);
+    for (size_t i = 0; i < docs->size; i++)
+    {
+        if (i)
+            fputc(',', out);
+        write_doc(out, get_from(docs, i));
+    }
+    docs->size = 0;
+    free_array(docs);
+
+    fputs("]}\n", out);
+}
+
+void stats_maybe_dump(void)
+{
+    static uint64_t last = 0;
+    if (!config.stats_interval_ms)
+        return;
+
+    uint64_t now = stats_now_ns();
+    if (last && now - last < (uint64_t)config.stats_interval_ms * 1000000)
+        return;
+    last = now;
+
+    FILE *f = fopen(config.stats_file, "a");
+    if (!f)
+        return;
+    stats_write_json(f);
+    fclose(f);
+}
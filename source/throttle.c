@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include "throttle.h"
+#include "ipc_helpers.h"
+#include "memory.h"
+#include "server_config.h"
+
+throttle *throttle_create(void)
+{
+    throttle *t = Calloc(1, sizeof(throttle));
+    t->buckets = hash_map_create(16);
+    return t;
+}
+
+void throttle_free(throttle *t)
+{
+    if (!t)
+        return;
+    hash_map_free(t->buckets, free);
+    free(t);
+}
+
+// Commands per second for a role, 0 = unlimited
+static double role_rate(const char *role)
+{
+    if (role && strcmp(role, "read") == 0 && config.rate_read)
+        return (double)config.rate_read;
+    return (double)config.rate;
+}
+
+static throttle_bucket *bucket_for(throttle *t, const cmd_ipc *c, const struct timespec *now)
+{
+    throttle_bucket *b = hash_map_get(t->buckets, c->username);
+    double rate = role_rate(c->role);
+    double burst = config.burst ? (double)config.burst : (rate > 1 ? rate : 1);
+
+    if (!b)
+    {
+        b = Calloc(1, sizeof(throttle_bucket));
+        b->tokens = burst;
+        b->refilled = *now;
+        hash_map_put(t->buckets, c->username, b);
+    }
+
+    if (b->last_tick != t->tick)
+    {
+        double elapsed = (double)(now->tv_sec - b->refilled.tv_sec) +
+                         (double)(now->tv_nsec - b->refilled.tv_nsec) / 1e9;
+        b->tokens += elapsed * rate;
+        if (b->tokens > burst)
+            b->tokens = burst;
+        b->refilled = *now;
+        b->last_tick = t->tick;
+    }
+    return b;
+}
+
+size_t throttle_admit(throttle *t, array_list *batch, array_list *carry)
+{
+    bool rate_limited = config.rate || config.rate_read;
+    if (!rate_limited && !config.tick_cmds && !config.tick_bytes)
+        return batch->size;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t->tick++;
+
+    size_t cmds_left = config.tick_cmds ? config.tick_cmds : SIZE_MAX;
+    size_t bytes_left = config.tick_bytes ? config.tick_bytes : SIZE_MAX;
+    bool budget_spent = false;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < batch->size; i++)
+    {
+        cmd_ipc *c = get_from(batch, i);
+        throttle_bucket *b = bucket_for(t, c, &now);
+        size_t bytes = strlen(c->raw_command);
+
+        // An oversized command still goes through on an otherwise empty tick
+        if (!budget_spent && (cmds_left == 0 || (bytes > bytes_left && kept > 0)))
+            budget_spent = true;
+
+        bool held = budget_spent || b->held_tick == t->tick ||
+                    (rate_limited && role_rate(c->role) > 0 && b->tokens < 1);
+
+        if (held)
+        {
+            // Counted once per command, however many ticks it waits
+            if (!c->held && budget_spent)
+                t->budget_deferred++;
+            else if (!c->held)
+                b->throttled++;
+            c->held = true;
+            b->held_tick = t->tick;
+            append_to(carry, c);
+            continue;
+        }
+
+        if (rate_limited && role_rate(c->role) > 0)
+            b->tokens -= 1;
+        b->admitted++;
+        cmds_left--;
+        bytes_left = bytes > bytes_left ? 0 : bytes_left - bytes;
+        batch->data[kept++] = c;
+    }
+
+    batch->size = kept;
+    return kept;
+}
+
+void throttle_report(const throttle *t, const char *doc_name, size_t carried, FILE *out)
+{
+    fprintf(out, "%s carried=%zu budget_deferred=%llu\n", doc_name, carried,
+            (unsigned long long)t->budget_deferred);
+
+    const hash_map *m = t->buckets;
+    for (size_t i = 0; i < m->capacity; i++)
+    {
+        const hash_entry *e = &m->entries[i];
+        if (!e->key)
+            continue;
+        const throttle_bucket *b = e->value;
+        fprintf(out, "%s user=%s admitted=%llu throttled=%llu tokens=%.1f\n", doc_name, e->key,
+                (unsigned long long)b->admitted, (unsigned long long)b->throttled, b->tokens);
+    }
+}
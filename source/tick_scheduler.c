@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "tick_scheduler.h"
+
+static void arm_timer(tick_scheduler *s, unsigned long period_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct itimerspec its = {0};
+    its.it_interval.tv_sec = period_ms / 1000;
+    its.it_interval.tv_nsec = (long)(period_ms % 1000) * 1000000L;
+
+    // First deadline is absolute; the kernel keeps later ones on the grid
+    its.it_value.tv_sec = now.tv_sec + its.it_interval.tv_sec;
+    its.it_value.tv_nsec = now.tv_nsec + its.it_interval.tv_nsec;
+    if (its.it_value.tv_nsec >= 1000000000L)
+    {
+        its.it_value.tv_sec++;
+        its.it_value.tv_nsec -= 1000000000L;
+    }
+
+    timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    s->timer_period_ms = period_ms;
+}
+
+static void disarm_timer(tick_scheduler *s)
+{
+    struct itimerspec its = {0};
+    timerfd_settime(s->timer_fd, 0, &its, NULL);
+    s->timer_period_ms = 0;
+}
+
+static void kick(tick_scheduler *s)
+{
+    uint64_t one = 1;
+    ssize_t r = write(s->wake_fd, &one, sizeof(one));
+    (void)r; // EAGAIN means a kick is already pending
+}
+
+int tick_scheduler_init(tick_scheduler *s, const server_config *cfg)
+{
+    s->interval_ms = cfg->interval_ms ? cfg->interval_ms : 1;
+    s->adaptive = cfg->adaptive;
+    s->early_cmds = cfg->early_cmds;
+    s->early_bytes = cfg->early_bytes;
+    s->heartbeat_ms = cfg->heartbeat_ms;
+    s->watch_input = true;
+    s->timer_period_ms = 0;
+
+    atomic_init(&s->pending_cmds, 0);
+    atomic_init(&s->pending_bytes, 0);
+    atomic_init(&s->idle, false);
+
+    s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (s->timer_fd < 0)
+        return -1;
+
+    s->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (s->wake_fd < 0)
+    {
+        close(s->timer_fd);
+        return -1;
+    }
+
+    arm_timer(s, s->interval_ms);
+    return 0;
+}
+
+void tick_scheduler_destroy(tick_scheduler *s)
+{
+    close(s->timer_fd);
+    close(s->wake_fd);
+}
+
+unsigned tick_scheduler_wait(tick_scheduler *s)
+{
+    struct pollfd fds[3] = {
+        {.fd = s->timer_fd, .events = POLLIN},
+        {.fd = s->wake_fd, .events = POLLIN},
+        {.fd = s->watch_input ? STDIN_FILENO : -1, .events = POLLIN},
+    };
+
+    // Client handshakes arrive as signals, so EINTR is routine here
+    while (poll(fds, 3, -1) < 0)
+    {
+        if (errno != EINTR)
+            return 0;
+    }
+
+    unsigned wake = 0;
+    uint64_t count;
+
+    if (fds[0].revents & POLLIN)
+    {
+        // More than one expiration means we overran; run a single tick
+        if (read(s->timer_fd, &count, sizeof(count)) == sizeof(count))
+            wake |= WAKE_TICK;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+        if (read(s->wake_fd, &count, sizeof(count)) == sizeof(count))
+            wake |= WAKE_TICK;
+        if (s->timer_period_ms != s->interval_ms)
+            arm_timer(s, s->interval_ms);
+    }
+
+    if (fds[2].revents & (POLLIN | POLLHUP | POLLERR))
+        wake |= WAKE_INPUT;
+
+    return wake;
+}
+
+void tick_scheduler_note_enqueue(tick_scheduler *s, size_t bytes)
+{
+    size_t cmds = atomic_fetch_add(&s->pending_cmds, 1) + 1;
+    size_t total = atomic_fetch_add(&s->pending_bytes, bytes) + bytes;
+
+    if (!s->adaptive)
+        return;
+
+    // First command after an idle stretch commits immediately
+    if (atomic_exchange(&s->idle, false))
+    {
+        kick(s);
+        return;
+    }
+
+    if (cmds == s->early_cmds ||
+        (total >= s->early_bytes && total - bytes < s->early_bytes))
+        kick(s);
+}
+
+void tick_scheduler_note_commit(tick_scheduler *s, size_t cmds, size_t bytes)
+{
+    atomic_fetch_sub(&s->pending_cmds, cmds);
+    atomic_fetch_sub(&s->pending_bytes, bytes);
+
+    if (!s->adaptive || cmds != 0 || s->timer_period_ms != s->interval_ms)
+        return;
+
+    // Commands held back by admission control still need the timer
+    if (atomic_load(&s->pending_cmds) > 0)
+        return;
+
+    // A whole interval passed with nothing to commit: stop waking up,
+    // apart from keepalives when heartbeats are enabled
+    if (s->heartbeat_ms)
+        arm_timer(s, s->heartbeat_ms);
+    else
+        disarm_timer(s);
+    atomic_store(&s->idle, true);
+
+    // A producer may have counted its command before `idle` was published
+    if (atomic_load(&s->pending_cmds) > 0 && atomic_exchange(&s->idle, false))
+        kick(s);
+}
+
+void tick_scheduler_ignore_input(tick_scheduler *s)
+{
+    s->watch_input = false;
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include "trace.h"
+
+#ifndef ENABLE_TRACE
+
+long trace_dump(const char *path)
+{
+    (void)path;
+    return -1;
+}
+
+#else
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "memory.h"
+
+#define TRACE_RING_SIZE 8192 // events per thread, a power of two
+
+// Events carry their thread's tid: a reused ring still holds the
+// previous owner's events, which must not be attributed to the new one
+typedef struct trace_event
+{
+    const char *name;
+    uint64_t ts_ns;
+    unsigned tid;
+    char phase; // 'M' marks a thread_name, kept for the dump of a reused ring
+} trace_event;
+
+// Written only by its thread. The head is published after each event,
+// so a dump reads without stopping the writer and drops whatever the
+// writer may have lapped meanwhile.
+typedef struct trace_ring
+{
+    atomic_uint_fast64_t head;
+    atomic_bool in_use;
+    unsigned tid;
+    const char *thread_name;
+    struct trace_ring *next;
+    trace_event events[TRACE_RING_SIZE];
+} trace_ring;
+
+static _Atomic(trace_ring *) rings = NULL; // push-only list
+static atomic_uint next_tid = 1;
+static _Thread_local trace_ring *my_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// Rings outlive their threads and are handed to the next new thread,
+// so churning client threads do not grow memory
+static void release_ring(void *ptr)
+{
+    trace_ring *r = ptr;
+    atomic_store(&r->in_use, false);
+}
+
+static void make_ring_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static trace_ring *acquire_ring(void)
+{
+    pthread_once(&ring_key_once, make_ring_key);
+
+    trace_ring *r;
+    for (r = atomic_load(&rings); r; r = r->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&r->in_use, &expected, true))
+            break;
+    }
+
+    if (!r)
+    {
+        r = Calloc(1, sizeof(trace_ring));
+        atomic_init(&r->in_use, true);
+        r->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+            ;
+    }
+
+    r->tid = atomic_fetch_add(&next_tid, 1);
+    r->thread_name = NULL;
+    my_ring = r;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+void trace_record(const char *name, char phase)
+{
+    trace_ring *r = my_ring ? my_ring : acquire_ring();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_event *e = &r->events[h & (TRACE_RING_SIZE - 1)];
+    e->name = name;
+    e->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    e->tid = r->tid;
+    e->phase = phase;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+void trace_thread_name(const char *name)
+{
+    trace_ring *r = my_ring ? my_ring : acquire_ring();
+    r->thread_name = name;
+    trace_record(name, 'M');
+}
+
+static void write_thread_name(FILE *f, bool *first, unsigned tid, const char *name)
+{
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+               "\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", (int)getpid(), tid, name);
+    *first = false;
+}
+
+static void write_event(FILE *f, bool *first, const trace_event *e)
+{
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u%s}",
+            *first ? "" : ",", e->name, e->phase, (double)e->ts_ns / 1e3, (int)getpid(), e->tid,
+            e->phase == 'i' ? ",\"s\":\"t\"" : "");
+    *first = false;
+}
+
+long trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    trace_event *copy = Calloc(TRACE_RING_SIZE, sizeof(trace_event));
+    bool first = true;
+    long written = 0;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+    for (trace_ring *r = atomic_load(&rings); r; r = r->next)
+    {
+        unsigned tid = r->tid;
+        if (r->thread_name)
+            write_thread_name(f, &first, tid, r->thread_name);
+
+        uint64_t end = atomic_load_explicit(&r->head, memory_order_acquire);
+        uint64_t base = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+        for (uint64_t i = base; i < end; i++)
+            copy[i - base] = r->events[i & (TRACE_RING_SIZE - 1)];
+
+        // Slots the writer reached while we copied may be torn
+        uint64_t start = base;
+        uint64_t now = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (now >= TRACE_RING_SIZE && now - TRACE_RING_SIZE + 1 > start)
+            start = now - TRACE_RING_SIZE + 1;
+
+        for (uint64_t i = start; i < end; i++)
+        {
+            const trace_event *e = &copy[i - base];
+            if (e->phase != 'M')
+            {
+                write_event(f, &first, e);
+                written++;
+            }
+            else if (e->tid != tid) // a previous owner's name
+                write_thread_name(f, &first, e->tid, e->name);
+        }
+    }
+    fputs("\n]}\n", f);
+
+    free(copy);
+    if (fclose(f) != 0)
+        return -1;
+    return written;
+}
+
+#endif
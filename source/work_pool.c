@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "work_pool.h"
+#include "memory.h"
+#include "trace.h"
+
+// pool->queued moves under the deque lock together with the task, so it
+// never counts a task that is not there or misses one that is
+static void deque_push(work_pool *pool, work_deque *q, work_task task)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->cap)
+    {
+        size_t cap = q->cap ? q->cap * 2 : 16;
+        work_task *tasks = Calloc(cap, sizeof(work_task));
+        for (size_t i = 0; i < q->count; i++)
+            tasks[i] = q->tasks[(q->head + i) % q->cap];
+        free(q->tasks);
+        q->tasks = tasks;
+        q->cap = cap;
+        q->head = 0;
+    }
+    q->tasks[(q->head + q->count) % q->cap] = task;
+    q->count++;
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Owner end: newest task first
+static bool deque_pop(work_pool *pool, work_deque *q, work_task *out)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->count > 0;
+    if (ok)
+    {
+        q->count--;
+        *out = q->tasks[(q->head + q->count) % q->cap];
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// Thief end: oldest task first
+static bool deque_steal(work_pool *pool, work_deque *q, work_task *out)
+{
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->count > 0;
+    if (ok)
+    {
+        *out = q->tasks[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// `self` is the caller's deque, or nthreads for a thread without one
+static bool take_task(work_pool *pool, size_t self, work_task *out)
+{
+    if (atomic_load(&pool->queued) == 0)
+        return false;
+
+    if (self < pool->nthreads && deque_pop(pool, &pool->deques[self], out))
+        return true;
+
+    for (size_t i = 1; i <= pool->nthreads; i++)
+    {
+        size_t victim = (self + i) % pool->nthreads;
+        if (deque_steal(pool, &pool->deques[victim], out))
+            return true;
+    }
+    return false;
+}
+
+static void run_task(work_pool *pool, work_task *task)
+{
+    task->fn(task->arg);
+
+    if (atomic_fetch_sub(&pool->unfinished, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+typedef struct worker_arg
+{
+    work_pool *pool;
+    size_t self;
+} worker_arg;
+
+static void *worker_main(void *arg)
+{
+    worker_arg *w = arg;
+    work_pool *pool = w->pool;
+    size_t self = w->self;
+    free(w);
+    TRACE_THREAD_NAME("worker");
+
+    while (1)
+    {
+        work_task task;
+        if (take_task(pool, self, &task))
+        {
+            run_task(pool, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        bool stop = pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop)
+            break;
+    }
+
+    return NULL;
+}
+
+work_pool *work_pool_create(size_t nthreads)
+{
+    if (nthreads == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = n > 0 ? (size_t)n : 1;
+    }
+
+    work_pool *pool = Calloc(1, sizeof(work_pool));
+    pool->nthreads = nthreads;
+    pool->threads = Calloc(nthreads, sizeof(pthread_t));
+    pool->deques = Calloc(nthreads, sizeof(work_deque));
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->unfinished, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    for (size_t i = 0; i < nthreads; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        worker_arg *w = Calloc(1, sizeof(worker_arg));
+        w->pool = pool;
+        w->self = i;
+        pthread_create(&pool->threads[i], NULL, worker_main, w);
+    }
+
+    return pool;
+}
+
+void work_pool_destroy(work_pool *pool)
+{
+    if (!pool)
+        return;
+
+    work_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (size_t i = 0; i < pool->nthreads; i++)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+void work_pool_submit(work_pool *pool, work_fn fn, void *arg)
+{
+    atomic_fetch_add(&pool->unfinished, 1);
+    deque_push(pool, &pool->deques[pool->next], (work_task){fn, arg});
+    pool->next = (pool->next + 1) % pool->nthreads;
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void work_pool_wait(work_pool *pool)
+{
+    while (atomic_load(&pool->unfinished) > 0)
+    {
+        work_task task;
+        if (take_task(pool, pool->nthreads, &task))
+        {
+            run_task(pool, &task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->unfinished) > 0 && atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->done_cv, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}